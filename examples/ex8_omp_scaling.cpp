@@ -0,0 +1,127 @@
+#include <functional>
+
+#include "lpm.h"
+#include "particle.h"
+#include "assembly.h"
+#include "utilities.h"
+#include "stiffness.h"
+#include "load_step.h"
+#include "solver_static.h"
+
+// Thread scaling of the per-iteration state-update passes (Assembly and Solver), on a 2D hexagon plate with damage
+// or a 3D simple cubic block with J2 plasticity (one system per run, the particle ids are global). Each pass is timed
+// for 1, 2, 4, ... threads up to the maximum (OMP_NUM_THREADS), and the speedup and parallel efficiency are printed
+// against one thread.
+
+template <int nlayer>
+void timePasses(const char *name, Assembly<nlayer> &pt_ass, std::vector<Particle<nlayer> *> &top, std::vector<Particle<nlayer> *> &bottom, int n_rep)
+{
+    std::vector<LoadStep<nlayer>> load(1);
+    load[0].dispBCs.push_back(DispBC<nlayer>(top, LoadMode::Relative, 'y', 0.0));
+    load[0].forceBCs.push_back(ForceBC<nlayer>(bottom, LoadMode::Relative, 0.0, 0.0, 0.0));
+    SolverStatic<nlayer> solv{-1, pt_ass, StiffnessMode::Analytical, SolverMode::CG, "scaling.dump", 1, 1e-5};
+
+    const char *pass_names[] = {"updateGeometry", "updateForceState", "updateGeometryForceState", "updateStateVar",
+                                "storeStateVar", "resetStateVar", "updateBrokenBonds", "updateRR", "BCs"};
+    const int n_pass = 9;
+    std::vector<std::function<void()>> passes{
+        [&]() { pt_ass.updateGeometry(); },
+        [&]() { pt_ass.updateForceState(); },
+        [&]() { pt_ass.updateGeometryForceState(); },
+        [&]() { pt_ass.updateStateVar(); },
+        [&]() { pt_ass.storeStateVar(); },
+        [&]() { pt_ass.resetStateVar(false); },
+        [&]() { pt_ass.updateBrokenBonds(); },
+        [&]() { solv.reaction_force.clear(); solv.updateRR(); },
+        [&]() { solv.updateDisplacementBC(load[0]); solv.updateForceBC(load[0]); }};
+
+    std::vector<int> threads;
+    for (int nt = 1; nt < omp_get_max_threads(); nt *= 2)
+        threads.push_back(nt);
+    threads.push_back(omp_get_max_threads());
+
+    printf("\n%s, %d particles, %d repetitions, time per call (ms) / speedup / efficiency\n", name, pt_ass.nparticle, n_rep);
+    printf("%-26s", "threads");
+    for (int nt : threads)
+        printf(" %22d", nt);
+    printf("\n");
+
+    int max_threads = omp_get_max_threads();
+    for (int p = 0; p < n_pass; ++p)
+    {
+        printf("%-26s", pass_names[p]);
+        double t1{0};
+        for (int nt : threads)
+        {
+            omp_set_num_threads(nt);
+            passes[p](); // warm up
+            double t = omp_get_wtime();
+            for (int r = 0; r < n_rep; ++r)
+                passes[p]();
+            t = (omp_get_wtime() - t) / n_rep * 1e3;
+            if (nt == 1)
+                t1 = t;
+            printf(" %9.3f %5.2f %5.2f", t, t1 / t, t1 / t / nt);
+        }
+        printf("\n");
+    }
+    omp_set_num_threads(max_threads);
+}
+
+void run()
+{
+    const int n_layer = 2;
+    const int n_rep = 20;
+    const bool hexagon_2d = true; // 2D hexagon plate, otherwise 3D simple cubic block
+    int eulerflag = 0;
+    double angles[] = {0.0, 0.0, 0.0};
+    double *R_matrix = createRMatrix(eulerflag, angles);
+
+    if (hexagon_2d)
+    {
+        // 2D hexagon plate, brittle damage
+        double radius = 0.05;
+        UnitCell cell(LatticeType::Hexagon2D, radius);
+        std::array<double, 2 * NDIM> box{0.0, 20.0, 0.0, 20.0, 0.0, 0.0};
+        std::vector<std::array<double, NDIM>> hex_xyz = createPlateHEX2D(box, cell, R_matrix);
+        Assembly<n_layer> pt_ass{hex_xyz, box, cell, ParticleType::ElasticDamage};
+
+        std::vector<Particle<n_layer> *> top, bottom;
+        for (Particle<n_layer> *p1 : pt_ass.pt_sys)
+        {
+            if (p1->xyz[1] > box[3] - 2 * radius)
+                top.push_back(p1);
+            if (p1->xyz[1] < box[2] + 2 * radius)
+                bottom.push_back(p1);
+            ParticleElasticDamage<n_layer> *elpt = dynamic_cast<ParticleElasticDamage<n_layer> *>(p1);
+            elpt->setParticleProperty(0.0, false, 3.2e3, 0.28, 0.1936, 1, 10, 0.99);
+        }
+        pt_ass.updateGeometry();
+        pt_ass.updateForceState();
+        timePasses("2D hexagon, elastic damage", pt_ass, top, bottom, n_rep);
+    }
+
+    else
+    {
+        // 3D simple cubic block, J2 plasticity
+        double radius = 0.2;
+        UnitCell cell(LatticeType::SimpleCubic3D, radius);
+        std::array<double, 2 * NDIM> box{0.0, 16.0, 0.0, 16.0, 0.0, 16.0};
+        std::vector<std::array<double, NDIM>> sc_xyz = createCuboidSC3D(box, cell, R_matrix);
+        Assembly<n_layer> pt_ass{sc_xyz, box, cell, ParticleType::J2Plasticity};
+
+        std::vector<Particle<n_layer> *> top, bottom;
+        for (Particle<n_layer> *p1 : pt_ass.pt_sys)
+        {
+            if (p1->xyz[1] > box[3] - 2 * radius)
+                top.push_back(p1);
+            if (p1->xyz[1] < box[2] + 2 * radius)
+                bottom.push_back(p1);
+            ParticleJ2Plasticity<n_layer> *elpt = dynamic_cast<ParticleJ2Plasticity<n_layer> *>(p1);
+            elpt->setParticleProperty(0.0, false, 146e3, 0.3, 200, 0.5, 38.714e3, 10, 1);
+        }
+        pt_ass.updateGeometry();
+        pt_ass.updateForceState();
+        timePasses("3D simple cubic, J2 plasticity", pt_ass, top, bottom, n_rep);
+    }
+}
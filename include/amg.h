@@ -0,0 +1,599 @@
+#pragma once
+#ifndef AMG_H
+#define AMG_H
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+#include "lpm.h"
+
+// Smoothed aggregation algebraic multigrid, applied as one symmetric V-cycle (weighted Jacobi smoothing) per CG
+// iteration. The aggregates of the first level come from the particle graph and its near null space from the rigid
+// body modes of the particles, the coarser levels aggregate the block graph of their Galerkin operators
+
+struct CSRMatrix
+{
+    MKL_INT nrow{0}, ncol{0};
+    std::vector<MKL_INT> ia, ja; // zero-based
+    std::vector<double> a;
+
+    void multiply(const double *x, double *y) const; // y = A x
+};
+
+void CSRMatrix::multiply(const double *x, double *y) const
+{
+#pragma omp parallel for
+    for (MKL_INT i = 0; i < nrow; ++i)
+    {
+        double s{0};
+        for (MKL_INT e = ia[i]; e < ia[i + 1]; ++e)
+            s += a[e] * x[ja[e]];
+        y[i] = s;
+    }
+}
+
+CSRMatrix multiplyCSR(const CSRMatrix &A, const CSRMatrix &B)
+{
+    // row by row (Gustavson), a symbolic pass for the row sizes and a numeric one
+    CSRMatrix C;
+    C.nrow = A.nrow, C.ncol = B.ncol;
+    C.ia.assign(A.nrow + 1, 0);
+#pragma omp parallel
+    {
+        std::vector<MKL_INT> mark(B.ncol, -1);
+#pragma omp for schedule(static)
+        for (MKL_INT i = 0; i < A.nrow; ++i)
+        {
+            MKL_INT count{0};
+            for (MKL_INT ea = A.ia[i]; ea < A.ia[i + 1]; ++ea)
+            {
+                MKL_INT k = A.ja[ea];
+                for (MKL_INT eb = B.ia[k]; eb < B.ia[k + 1]; ++eb)
+                {
+                    if (mark[B.ja[eb]] != i)
+                        mark[B.ja[eb]] = i, ++count;
+                }
+            }
+            C.ia[i + 1] = count;
+        }
+    }
+    for (MKL_INT i = 0; i < A.nrow; ++i)
+        C.ia[i + 1] += C.ia[i];
+
+    C.ja.resize(C.ia[A.nrow]);
+    C.a.resize(C.ia[A.nrow]);
+#pragma omp parallel
+    {
+        std::vector<MKL_INT> pos(B.ncol, -1); // positions of earlier rows are below the start of the current one
+#pragma omp for schedule(static)
+        for (MKL_INT i = 0; i < A.nrow; ++i)
+        {
+            MKL_INT start = C.ia[i], end = C.ia[i];
+            for (MKL_INT ea = A.ia[i]; ea < A.ia[i + 1]; ++ea)
+            {
+                MKL_INT k = A.ja[ea];
+                for (MKL_INT eb = B.ia[k]; eb < B.ia[k + 1]; ++eb)
+                {
+                    MKL_INT j = B.ja[eb];
+                    if (pos[j] < start)
+                    {
+                        pos[j] = end;
+                        C.ja[end] = j;
+                        C.a[end++] = A.a[ea] * B.a[eb];
+                    }
+                    else
+                        C.a[pos[j]] += A.a[ea] * B.a[eb];
+                }
+            }
+        }
+    }
+    return C;
+}
+
+CSRMatrix transposeCSR(const CSRMatrix &A)
+{
+    CSRMatrix T;
+    T.nrow = A.ncol, T.ncol = A.nrow;
+    T.ia.assign(A.ncol + 1, 0);
+    for (MKL_INT e = 0; e < A.ia[A.nrow]; ++e)
+        ++T.ia[A.ja[e] + 1];
+    for (MKL_INT j = 0; j < A.ncol; ++j)
+        T.ia[j + 1] += T.ia[j];
+
+    std::vector<MKL_INT> next(T.ia.begin(), T.ia.end() - 1);
+    T.ja.resize(A.ia[A.nrow]);
+    T.a.resize(A.ia[A.nrow]);
+    for (MKL_INT i = 0; i < A.nrow; ++i)
+    {
+        for (MKL_INT e = A.ia[i]; e < A.ia[i + 1]; ++e)
+        {
+            MKL_INT p = next[A.ja[e]]++;
+            T.ja[p] = i;
+            T.a[p] = A.a[e];
+        }
+    }
+    return T;
+}
+
+CSRMatrix symmetricCSR(MKL_INT n, const MKL_INT *IK, const MKL_INT *JK, std::vector<MKL_INT> &src)
+{
+    // both triangles of the one-based upper triangle CSR, src is the upper triangle entry of each entry, the rows are
+    // filled in increasing order so the columns stay sorted
+    CSRMatrix A;
+    A.nrow = n, A.ncol = n;
+    A.ia.assign(n + 1, 0);
+    for (MKL_INT r = 0; r < n; ++r)
+    {
+        for (MKL_INT e = IK[r] - 1; e < IK[r + 1] - 1; ++e)
+        {
+            ++A.ia[r + 1];
+            if (JK[e] - 1 != r)
+                ++A.ia[JK[e]];
+        }
+    }
+    for (MKL_INT r = 0; r < n; ++r)
+        A.ia[r + 1] += A.ia[r];
+    A.ja.resize(A.ia[n]);
+    A.a.resize(A.ia[n]);
+    src.resize(A.ia[n]);
+    std::vector<MKL_INT> next(A.ia.begin(), A.ia.end() - 1);
+    for (MKL_INT r = 0; r < n; ++r)
+    {
+        for (MKL_INT e = IK[r] - 1; e < IK[r + 1] - 1; ++e)
+        {
+            MKL_INT c = JK[e] - 1;
+            A.ja[next[r]] = c, src[next[r]++] = e;
+            if (c != r)
+                A.ja[next[c]] = r, src[next[c]++] = e;
+        }
+    }
+    return A;
+}
+
+void blockGraph(const CSRMatrix &A, const std::vector<MKL_INT> &node_ptr, std::vector<MKL_INT> &g_ptr, std::vector<MKL_INT> &g_adj)
+{
+    // node graph of the blocks of A (node_ptr holds the first row of each node and the size at the end), the node
+    // itself is not listed
+    int nnode = (int)node_ptr.size() - 1;
+    std::vector<int> node_of(A.nrow);
+    for (int I = 0; I < nnode; ++I)
+        for (MKL_INT d = node_ptr[I]; d < node_ptr[I + 1]; ++d)
+            node_of[d] = I;
+    g_ptr.assign(1, 0);
+    g_adj.clear();
+    std::vector<int> mark(nnode, -1);
+    for (int I = 0; I < nnode; ++I)
+    {
+        mark[I] = I;
+        for (MKL_INT d = node_ptr[I]; d < node_ptr[I + 1]; ++d)
+        {
+            for (MKL_INT e = A.ia[d]; e < A.ia[d + 1]; ++e)
+            {
+                int J = node_of[A.ja[e]];
+                if (mark[J] != I)
+                    mark[J] = I, g_adj.push_back(J);
+            }
+        }
+        g_ptr.push_back(g_adj.size());
+    }
+}
+
+// dense Cholesky factor of a small operator (the coarsest level of a multigrid)
+class DenseCholesky
+{
+    std::vector<double> L; // row-major, lower triangle
+    MKL_INT n{0};
+
+public:
+    bool factor(const CSRMatrix &A, const std::vector<double> &dinv, MKL_INT max_n); // false (and empty) if A is larger than max_n
+    bool empty() const { return L.empty(); }
+    void solve(const double *b, double *x) const;
+};
+
+bool DenseCholesky::factor(const CSRMatrix &A, const std::vector<double> &dinv, MKL_INT max_n)
+{
+    // a vanishing pivot (eliminated DOF) is replaced by the diagonal
+    n = A.nrow;
+    L.clear();
+    if (n > max_n)
+        return false;
+
+    L.assign(n * n, 0.0);
+    for (MKL_INT i = 0; i < n; ++i)
+        for (MKL_INT e = A.ia[i]; e < A.ia[i + 1]; ++e)
+            L[i * n + A.ja[e]] = A.a[e];
+
+    for (MKL_INT k = 0; k < n; ++k)
+    {
+        double &d = L[k * n + k];
+        double diag = (dinv[k] > 0) ? 1.0 / dinv[k] : 1.0;
+        d = (d > 1e-12 * diag) ? std::sqrt(d) : std::sqrt(diag);
+        for (MKL_INT i = k + 1; i < n; ++i)
+            L[i * n + k] /= d;
+#pragma omp parallel for
+        for (MKL_INT j = k + 1; j < n; ++j)
+        {
+            double ljk = L[j * n + k];
+            for (MKL_INT i = j; i < n; ++i)
+                L[i * n + j] -= L[i * n + k] * ljk;
+        }
+    }
+    return true;
+}
+
+void DenseCholesky::solve(const double *b, double *x) const
+{
+    // L y = b, then L^T x = y
+    for (MKL_INT i = 0; i < n; ++i)
+    {
+        double s = b[i];
+        for (MKL_INT k = 0; k < i; ++k)
+            s -= L[i * n + k] * x[k];
+        x[i] = s / L[i * n + i];
+    }
+    for (MKL_INT i = n - 1; i >= 0; --i)
+    {
+        double s = x[i];
+        for (MKL_INT k = i + 1; k < n; ++k)
+            s -= L[k * n + i] * x[k];
+        x[i] = s / L[i * n + i];
+    }
+}
+
+class AMG
+{
+    struct Level
+    {
+        CSRMatrix A, P, R;           // operator, prolongator from the next level and restriction (P^T)
+        std::vector<double> dinv;    // inverse diagonal of A
+        double omega{0};             // Jacobi weight, 4 / 3 / rho(D^-1 A)
+        std::vector<double> x, b, r; // work vectors of the cycle
+    };
+
+    std::vector<Level> levels;
+    std::vector<MKL_INT> fine_src;     // entry of the upper triangle system of each entry of the first level operator
+    DenseCholesky coarse;              // factor of the coarsest operator, empty if it is smoothed instead
+
+    void smoothingWeight(Level &L);
+    void aggregate(const std::vector<MKL_INT> &g_ptr, const std::vector<MKL_INT> &g_adj, std::vector<int> &agg, int &nagg);
+    void factorCoarse();
+    void solveCoarse(Level &L);
+    void cycle(size_t l);
+
+public:
+    int max_levels{10}, coarse_size{500}, n_smooth{2};
+
+    // blocks: first DOF of each node (particle) and n at the end; g_ptr/g_adj: node graph without the node itself;
+    // B: near null space, nB columns for each DOF (row-major)
+    void setup(MKL_INT n, const MKL_INT *IK, const MKL_INT *JK, const double *K, const std::vector<MKL_INT> &blocks,
+               const std::vector<MKL_INT> &g_ptr, const std::vector<MKL_INT> &g_adj, const std::vector<double> &B, int nB);
+    void updateFine(const double *K); // new values of the first level, same pattern, the coarse levels are kept
+    void apply(const double *r, double *z);
+};
+
+void AMG::setup(MKL_INT n, const MKL_INT *IK, const MKL_INT *JK, const double *K, const std::vector<MKL_INT> &blocks,
+                const std::vector<MKL_INT> &g_ptr, const std::vector<MKL_INT> &g_adj, const std::vector<double> &B, int nB)
+{
+    levels.clear();
+    levels.emplace_back();
+
+    // first level operator with both triangles
+    CSRMatrix &A0 = levels[0].A;
+    A0 = symmetricCSR(n, IK, JK, fine_src);
+#pragma omp parallel for
+    for (MKL_INT e = 0; e < (MKL_INT)fine_src.size(); ++e)
+        A0.a[e] = K[fine_src[e]];
+    smoothingWeight(levels[0]);
+
+    std::vector<MKL_INT> node_ptr(blocks), graph_ptr(g_ptr), graph_adj(g_adj);
+    std::vector<double> Bl(B);
+    int nBl = nB;
+    while (levels.back().A.nrow > coarse_size && (int)levels.size() < max_levels)
+    {
+        size_t l = levels.size() - 1;
+        MKL_INT nl = levels[l].A.nrow;
+        int nnode = (int)node_ptr.size() - 1;
+
+        std::vector<int> agg;
+        int nagg{0};
+        aggregate(graph_ptr, graph_adj, agg, nagg);
+
+        // tentative prolongator: orthonormal basis of the near null space restricted to each aggregate (modified
+        // Gram-Schmidt, dependent columns are dropped), the coefficients are the near null space of the next level
+        std::vector<std::vector<int>> members(nagg);
+        for (int i = 0; i < nnode; ++i)
+        {
+            if (agg[i] >= 0)
+                members[agg[i]].push_back(i);
+        }
+        CSRMatrix T;
+        T.nrow = nl;
+        T.ia.assign(nl + 1, 0);
+        std::vector<std::vector<double>> Tval(nl);
+        std::vector<std::vector<MKL_INT>> Tcol(nl);
+        std::vector<MKL_INT> node_ptr_c{0};
+        std::vector<double> B_c;
+        for (int ag = 0; ag < nagg; ++ag)
+        {
+            std::vector<MKL_INT> dofs;
+            for (int i : members[ag])
+                for (MKL_INT d = node_ptr[i]; d < node_ptr[i + 1]; ++d)
+                    dofs.push_back(d);
+            size_t m = dofs.size();
+
+            std::vector<std::vector<double>> Q;
+            std::vector<std::array<double, 6>> Rk; // rows of R, nB <= 6
+            for (int c = 0; c < nBl; ++c)
+            {
+                std::vector<double> v(m);
+                double norm0{0};
+                for (size_t i = 0; i < m; ++i)
+                    v[i] = Bl[dofs[i] * nBl + c], norm0 += v[i] * v[i];
+                norm0 = std::sqrt(norm0);
+                for (size_t q = 0; q < Q.size(); ++q)
+                {
+                    double proj{0};
+                    for (size_t i = 0; i < m; ++i)
+                        proj += Q[q][i] * v[i];
+                    Rk[q][c] = proj;
+                    for (size_t i = 0; i < m; ++i)
+                        v[i] -= proj * Q[q][i];
+                }
+                double nv{0};
+                for (size_t i = 0; i < m; ++i)
+                    nv += v[i] * v[i];
+                nv = std::sqrt(nv);
+                if (norm0 > 0 && nv > 1e-8 * norm0)
+                {
+                    for (size_t i = 0; i < m; ++i)
+                        v[i] /= nv;
+                    Q.push_back(v);
+                    Rk.push_back(std::array<double, 6>{});
+                    Rk.back()[c] = nv;
+                }
+            }
+            if (Q.empty())
+                continue; // only eliminated DOFs, left to the smoother
+
+            MKL_INT col0 = node_ptr_c.back();
+            for (size_t i = 0; i < m; ++i)
+            {
+                for (size_t q = 0; q < Q.size(); ++q)
+                    Tcol[dofs[i]].push_back(col0 + q), Tval[dofs[i]].push_back(Q[q][i]);
+            }
+            for (size_t q = 0; q < Q.size(); ++q)
+                for (int c = 0; c < nBl; ++c)
+                    B_c.push_back(Rk[q][c]);
+            node_ptr_c.push_back(col0 + Q.size());
+        }
+        MKL_INT nc = node_ptr_c.back();
+        if (nc == 0 || nc > 0.8 * nl)
+            break; // the coarsening stagnates
+
+        T.ncol = nc;
+        for (MKL_INT i = 0; i < nl; ++i)
+            T.ia[i + 1] = T.ia[i] + Tcol[i].size();
+        for (MKL_INT i = 0; i < nl; ++i)
+        {
+            T.ja.insert(T.ja.end(), Tcol[i].begin(), Tcol[i].end());
+            T.a.insert(T.a.end(), Tval[i].begin(), Tval[i].end());
+        }
+
+        // smoothed prolongator P = (I - omega D^-1 A) T and the Galerkin operator of the next level
+        Level &L = levels[l];
+        CSRMatrix AT = multiplyCSR(L.A, T);
+        CSRMatrix &P = AT;
+#pragma omp parallel for
+        for (MKL_INT i = 0; i < nl; ++i)
+        {
+            for (MKL_INT e = P.ia[i]; e < P.ia[i + 1]; ++e)
+                P.a[e] *= -L.omega * L.dinv[i];
+            for (MKL_INT et = T.ia[i]; et < T.ia[i + 1]; ++et)
+            {
+                for (MKL_INT e = P.ia[i]; e < P.ia[i + 1]; ++e)
+                {
+                    if (P.ja[e] == T.ja[et])
+                    {
+                        P.a[e] += T.a[et];
+                        break;
+                    }
+                }
+            }
+        }
+        L.P = P;
+        L.R = transposeCSR(L.P);
+        CSRMatrix A_c = multiplyCSR(L.R, multiplyCSR(L.A, L.P));
+
+        // node graph of the next level from the blocks of its operator
+        std::vector<MKL_INT> gp_c, ga_c;
+        blockGraph(A_c, node_ptr_c, gp_c, ga_c);
+
+        levels.emplace_back();
+        levels.back().A = std::move(A_c);
+        smoothingWeight(levels.back());
+        node_ptr.swap(node_ptr_c);
+        graph_ptr.swap(gp_c);
+        graph_adj.swap(ga_c);
+        Bl.swap(B_c);
+    }
+
+    for (Level &L : levels)
+    {
+        L.x.assign(L.A.nrow, 0.0);
+        L.b.assign(L.A.nrow, 0.0);
+        L.r.assign(L.A.nrow, 0.0);
+    }
+    factorCoarse();
+
+    double nnz{0};
+    for (Level &L : levels)
+        nnz += L.A.ia[L.A.nrow];
+    printf("    AMG: %zu levels, coarsest %lld DOFs, operator complexity %.2f\n", levels.size(), (long long)levels.back().A.nrow, nnz / levels[0].A.ia[n]);
+}
+
+void AMG::updateFine(const double *K)
+{
+    Level &L = levels[0];
+#pragma omp parallel for
+    for (MKL_INT e = 0; e < (MKL_INT)fine_src.size(); ++e)
+        L.A.a[e] = K[fine_src[e]];
+    smoothingWeight(L);
+    if (levels.size() == 1)
+        factorCoarse();
+}
+
+void AMG::smoothingWeight(Level &L)
+{
+    MKL_INT n = L.A.nrow;
+    L.dinv.assign(n, 1.0);
+#pragma omp parallel for
+    for (MKL_INT i = 0; i < n; ++i)
+    {
+        for (MKL_INT e = L.A.ia[i]; e < L.A.ia[i + 1]; ++e)
+        {
+            if (L.A.ja[e] == i && L.A.a[e] > 0)
+                L.dinv[i] = 1.0 / L.A.a[e];
+        }
+    }
+
+    // spectral radius of D^-1 A by power iterations
+    std::vector<double> v(n), w(n);
+    for (MKL_INT i = 0; i < n; ++i)
+        v[i] = 1.0 + (i % 7) * 0.1;
+    double rho{1.0};
+    for (int it = 0; it < 15; ++it)
+    {
+        double nv{0};
+        for (MKL_INT i = 0; i < n; ++i)
+            nv += v[i] * v[i];
+        nv = std::sqrt(nv);
+        if (nv == 0)
+            break;
+        for (MKL_INT i = 0; i < n; ++i)
+            v[i] /= nv;
+        L.A.multiply(v.data(), w.data());
+        double nw{0};
+        for (MKL_INT i = 0; i < n; ++i)
+            w[i] *= L.dinv[i], nw += w[i] * w[i];
+        rho = std::sqrt(nw);
+        v.swap(w);
+    }
+    L.omega = 4.0 / 3.0 / std::max(rho, 1e-12);
+}
+
+void AMG::aggregate(const std::vector<MKL_INT> &g_ptr, const std::vector<MKL_INT> &g_adj, std::vector<int> &agg, int &nagg)
+{
+    // 1. a node with no aggregated neighbor starts an aggregate with its neighbors, 2. the other nodes join the
+    // aggregate of a neighbor, 3. isolated nodes are aggregates of their own
+    int nnode = (int)g_ptr.size() - 1;
+    agg.assign(nnode, -1);
+    nagg = 0;
+    for (int i = 0; i < nnode; ++i)
+    {
+        if (agg[i] >= 0)
+            continue;
+        bool free_nbr{true};
+        for (MKL_INT e = g_ptr[i]; e < g_ptr[i + 1] && free_nbr; ++e)
+            free_nbr = (agg[g_adj[e]] < 0);
+        if (!free_nbr)
+            continue;
+        agg[i] = nagg;
+        for (MKL_INT e = g_ptr[i]; e < g_ptr[i + 1]; ++e)
+            agg[g_adj[e]] = nagg;
+        ++nagg;
+    }
+
+    std::vector<int> agg1(agg);
+    for (int i = 0; i < nnode; ++i)
+    {
+        if (agg[i] >= 0)
+            continue;
+        for (MKL_INT e = g_ptr[i]; e < g_ptr[i + 1]; ++e)
+        {
+            if (agg1[g_adj[e]] >= 0)
+            {
+                agg[i] = agg1[g_adj[e]];
+                break;
+            }
+        }
+        if (agg[i] < 0)
+            agg[i] = nagg++;
+    }
+}
+
+void AMG::factorCoarse()
+{
+    // dense if it is small enough, the coarsening may stagnate above coarse_size
+    coarse.factor(levels.back().A, levels.back().dinv, 3 * coarse_size);
+}
+
+void AMG::solveCoarse(Level &L)
+{
+    MKL_INT n = L.A.nrow;
+    if (coarse.empty())
+    {
+        // too large for a dense factorization, smoothed only
+        std::fill(L.x.begin(), L.x.end(), 0.0);
+        for (int s = 0; s < 10 * n_smooth; ++s)
+        {
+            L.A.multiply(L.x.data(), L.r.data());
+#pragma omp parallel for
+            for (MKL_INT i = 0; i < n; ++i)
+                L.x[i] += L.omega * L.dinv[i] * (L.b[i] - L.r[i]);
+        }
+        return;
+    }
+
+    coarse.solve(L.b.data(), L.x.data());
+}
+
+void AMG::cycle(size_t l)
+{
+    Level &L = levels[l];
+    if (l + 1 == levels.size())
+    {
+        solveCoarse(L);
+        return;
+    }
+
+    // pre-smoothing from zero, residual to the next level, correction, and the same post-smoothing (symmetric)
+    MKL_INT n = L.A.nrow;
+    std::fill(L.x.begin(), L.x.end(), 0.0);
+    for (int s = 0; s < n_smooth; ++s)
+    {
+        L.A.multiply(L.x.data(), L.r.data());
+#pragma omp parallel for
+        for (MKL_INT i = 0; i < n; ++i)
+            L.x[i] += L.omega * L.dinv[i] * (L.b[i] - L.r[i]);
+    }
+
+    L.A.multiply(L.x.data(), L.r.data());
+#pragma omp parallel for
+    for (MKL_INT i = 0; i < n; ++i)
+        L.r[i] = L.b[i] - L.r[i];
+    L.R.multiply(L.r.data(), levels[l + 1].b.data());
+    cycle(l + 1);
+    L.P.multiply(levels[l + 1].x.data(), L.r.data());
+#pragma omp parallel for
+    for (MKL_INT i = 0; i < n; ++i)
+        L.x[i] += L.r[i];
+
+    for (int s = 0; s < n_smooth; ++s)
+    {
+        L.A.multiply(L.x.data(), L.r.data());
+#pragma omp parallel for
+        for (MKL_INT i = 0; i < n; ++i)
+            L.x[i] += L.omega * L.dinv[i] * (L.b[i] - L.r[i]);
+    }
+}
+
+void AMG::apply(const double *r, double *z)
+{
+    std::copy(r, r + levels[0].A.nrow, levels[0].b.begin());
+    cycle(0);
+    std::copy(levels[0].x.begin(), levels[0].x.end(), z);
+}
+
+#endif
@@ -11,13 +11,16 @@
 #include "lpm.h"
 #include "unit_cell.h"
 #include "bond.h"
+#include "cell_list.h"
 #include "particle_elastic.h"
 #include "particle_elastic_damage.h"
 #include "particle_fatigue_hcf.h"
 #include "particle_j2plasticity.h"
+#include "particle_arena.h"
+#include "particle_order.h"
 
 template <int nlayer>
-class Bond;
+class BondStore;
 
 template <int nlayer>
 class Particle;
@@ -43,21 +46,36 @@ class Assembly
 public:
     ParticleType ptype;                     // particle type
     int nparticle;                          // number of particles
-    std::vector<Particle<nlayer> *> pt_sys; // system of particles
+    ParticleArena<nlayer> arena;            // storage of all particles
+    std::vector<Particle<nlayer> *> pt_sys; // system of particles (stored in the arena)
+    BondStore<nlayer> *bonds{nullptr};      // all bonds of the particle system, shared by the particles
     std::array<double, 2 * NDIM> box;       // simulation box
 
-    Assembly(std::vector<std::array<double, NDIM>> &p_xyz, std::array<double, 2 * NDIM> &p_box, UnitCell &p_cell, const ParticleType &p_ptype); // Construct a particle system from scratch
-    Assembly(const std::string &dumpFile, UnitCell &p_cell, const ParticleType &p_ptype);                                                       // Assemble the particle system from the dump file
-    Assembly(const std::string &dumpFile, const std::string &bondFile, UnitCell &p_cell, const ParticleType &p_ptype);                          // Assemble the particle system from the dump file
+    std::vector<int> nonlocal_ptr, nonlocal_idx; // CSR table of nonlocal neighbors, row pointer and particle index
+    std::vector<double> nonlocal_wt;             // nonlocal weight of each neighbor, func_phi(dis, L) * V_m
 
-    void createParticles(std::vector<std::array<double, NDIM>> &p_xyz, UnitCell &p_cell);
+    bool wide_conns{false}; // conns reach one bond further, as far as the return mapping of a neighbor (consistent plastic tangent)
+
+    // particles can be renumbered for locality (p_reorder) before the bonds are created, id is then the new number and id_initial the input one
+    Assembly(std::vector<std::array<double, NDIM>> &p_xyz, std::array<double, 2 * NDIM> &p_box, UnitCell &p_cell, const ParticleType &p_ptype, const ReorderMode &p_reorder = ReorderMode::None); // Construct a particle system from scratch
+    Assembly(const std::string &dumpFile, UnitCell &p_cell, const ParticleType &p_ptype, const ReorderMode &p_reorder = ReorderMode::None);                                                       // Assemble the particle system from the dump file
+    Assembly(const std::string &dumpFile, const std::string &bondFile, UnitCell &p_cell, const ParticleType &p_ptype, const ReorderMode &p_reorder = ReorderMode::None);                          // Assemble the particle system from the dump file
+    Assembly(const Assembly<nlayer> &) = delete;                                                                                                                                                  // particles and bonds are owned by the assembly, so it can not be copied
+    Assembly<nlayer> &operator=(const Assembly<nlayer> &) = delete;
+    ~Assembly() { delete bonds; }
+
+    void createParticles(std::vector<std::array<double, NDIM>> &p_xyz, UnitCell &p_cell, const ReorderMode &p_reorder);
     void createBonds();
+    void allocateBonds(const std::vector<std::array<int, nlayer>> &nbonds);
+    void linkOppositeBonds();
     void updateConnections();
     void updateGeometry();
     void resetStateVar(bool reset_xyz);
     void storeStateVar();
     void updateForceState(); // update bond force and particle forces
+    void updateGeometryForceState(); // updateGeometry and updateForceState fused into two sweeps over the bonds
     void searchNonlocalNeighbors(double cutoff_ratio);
+    void updateNonlocalDamageRate(int undamaged_pt_type);
 
     void updateStateVar();
     bool updateBrokenBonds();
@@ -65,27 +83,27 @@ public:
     std::map<int, Particle<nlayer> *> toMap();
     void readBond(const std::string &bondFile);
     void writeBond(const std::string &bondFile);
-    void readDump(const std::string &dumpFile, UnitCell &cell);
+    void readDump(const std::string &dumpFile, UnitCell &cell, const ReorderMode &p_reorder);
     void writeDump(const std::string &dumpFile, int step);
     void writeConfigurationDump(const std::string &dumpFile);
 };
 
 template <int nlayer>
-Assembly<nlayer>::Assembly(const std::string &dumpFile, UnitCell &p_cell, const ParticleType &p_ptype)
+Assembly<nlayer>::Assembly(const std::string &dumpFile, UnitCell &p_cell, const ParticleType &p_ptype, const ReorderMode &p_reorder)
 {
     ptype = p_ptype;
     printf("Reading data ...\n");
-    readDump(dumpFile, p_cell); // extract the particle system
+    readDump(dumpFile, p_cell, p_reorder); // extract the particle system
     createBonds();
     updateConnections();
 }
 
 template <int nlayer>
-Assembly<nlayer>::Assembly(const std::string &dumpFile, const std::string &bondFile, UnitCell &p_cell, const ParticleType &p_ptype)
+Assembly<nlayer>::Assembly(const std::string &dumpFile, const std::string &bondFile, UnitCell &p_cell, const ParticleType &p_ptype, const ReorderMode &p_reorder)
 {
     ptype = p_ptype;
     printf("Reading data ...\n");
-    readDump(dumpFile, p_cell);
+    readDump(dumpFile, p_cell, p_reorder);
     readBond(bondFile);
 
     for (Particle<nlayer> *p1 : pt_sys)
@@ -95,11 +113,11 @@ Assembly<nlayer>::Assembly(const std::string &dumpFile, const std::string &bondF
 }
 
 template <int nlayer>
-Assembly<nlayer>::Assembly(std::vector<std::array<double, NDIM>> &p_xyz, std::array<double, 2 * NDIM> &p_box, UnitCell &p_cell, const ParticleType &p_ptype)
+Assembly<nlayer>::Assembly(std::vector<std::array<double, NDIM>> &p_xyz, std::array<double, 2 * NDIM> &p_box, UnitCell &p_cell, const ParticleType &p_ptype, const ReorderMode &p_reorder)
 {
     ptype = p_ptype;
     box = p_box;
-    createParticles(p_xyz, p_cell);
+    createParticles(p_xyz, p_cell, p_reorder);
     createBonds();
     updateConnections();
     nparticle = pt_sys.size();
@@ -117,15 +135,104 @@ std::map<int, Particle<nlayer> *> Assembly<nlayer>::toMap()
 template <int nlayer>
 void Assembly<nlayer>::searchNonlocalNeighbors(double cutoff_ratio)
 {
+    double t1 = omp_get_wtime();
+
+    double cutoff{0}; // largest nonlocal cutoff radius
+    std::vector<std::array<double, NDIM>> xyz_sys;
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        xyz_sys.push_back(pt->xyz);
+        cutoff = std::max(cutoff, cutoff_ratio * pt->nonlocal_L);
+    }
+
+    int n = (int)pt_sys.size();
+    nonlocal_ptr.clear(), nonlocal_idx.clear(), nonlocal_wt.clear();
+    if (cutoff < EPS)
+        return; // no nonlocal interaction, leave the table empty
+
+    nonlocal_ptr = std::vector<int>(n + 1, 0);
+    CellList cells(xyz_sys, cutoff);
+
+    // count the nonlocal neighbors of each particle
+#pragma omp parallel
+    {
+        std::vector<int> candidates;
+#pragma omp for
+        for (int i = 0; i < n; ++i)
+        {
+            Particle<nlayer> *p1 = pt_sys[i];
+            cells.findCandidates(p1->xyz, cutoff_ratio * p1->nonlocal_L, candidates);
+            for (int j : candidates)
+            {
+                if (p1->distanceTo(pt_sys[j]) < cutoff_ratio * (p1->nonlocal_L))
+                    ++nonlocal_ptr[i + 1];
+            }
+        }
+    }
+
+    for (int i = 0; i < n; ++i)
+        nonlocal_ptr[i + 1] += nonlocal_ptr[i];
+
+    // fill in the neighbor index and the weight (reference configuration)
+    nonlocal_idx = std::vector<int>(nonlocal_ptr[n]);
+    nonlocal_wt = std::vector<double>(nonlocal_ptr[n]);
+#pragma omp parallel
+    {
+        std::vector<int> candidates;
+#pragma omp for
+        for (int i = 0; i < n; ++i)
+        {
+            Particle<nlayer> *p1 = pt_sys[i];
+            int k = nonlocal_ptr[i];
+            cells.findCandidates(p1->xyz, cutoff_ratio * p1->nonlocal_L, candidates);
+            for (int j : candidates)
+            {
+                Particle<nlayer> *p2 = pt_sys[j];
+                double dis = p1->distanceTo(p2);
+                if (dis < cutoff_ratio * (p1->nonlocal_L))
+                {
+                    double V_m = p2->cell.particle_volume * p2->nb / p2->cell.nneighbors;
+                    nonlocal_idx[k] = j;
+                    nonlocal_wt[k] = func_phi(dis, p1->nonlocal_L) * V_m;
+                    ++k;
+                }
+            }
+        }
+    }
+
+    double t2 = omp_get_wtime();
+    printf("Nonlocal neighbor search costs %f seconds, %d neighbors in total\n", t2 - t1, nonlocal_ptr[n]);
+}
+
+template <int nlayer>
+void Assembly<nlayer>::updateNonlocalDamageRate(int undamaged_pt_type)
+{
+    // nonlocal damage rate is the weighted average of the local ones, i.e., a sparse matrix-vector product
+    if (nonlocal_ptr.empty())
+        return; // nonlocal neighbors have not been searched
+
+    int n = (int)pt_sys.size();
+    std::vector<double> Ddot(n), mask(n);
 #pragma omp parallel for
-    for (Particle<nlayer> *p1 : pt_sys)
+    for (int i = 0; i < n; ++i)
     {
-        for (Particle<nlayer> *p2 : pt_sys)
+        mask[i] = (pt_sys[i]->type != undamaged_pt_type) ? 1.0 : 0.0;
+        Ddot[i] = (pt_sys[i]->type != undamaged_pt_type) ? pt_sys[i]->Ddot_local : 0.0;
+    }
+
+#pragma omp parallel for
+    for (int i = 0; i < n; ++i)
+    {
+        if (pt_sys[i]->type == undamaged_pt_type)
+            continue;
+
+        double D{0}, A{0};
+        for (int k = nonlocal_ptr[i]; k < nonlocal_ptr[i + 1]; ++k)
         {
-            if (p1->distanceTo(p2) < cutoff_ratio * (p1->nonlocal_L))
-                p1->neighbors_nonlocal.push_back(p2);
+            D += nonlocal_wt[k] * Ddot[nonlocal_idx[k]];
+            A += nonlocal_wt[k] * mask[nonlocal_idx[k]];
         }
-        // std::cout<<p1->id<<std::endl;
+        pt_sys[i]->Ddot_nonlocal = D / A;
     }
 }
 
@@ -133,6 +240,7 @@ template <int nlayer>
 void Assembly<nlayer>::updateGeometry()
 {
     // update particle geometry
+#pragma omp parallel for
     for (Particle<nlayer> *pt : pt_sys)
         pt->updateBondsGeometry();
 }
@@ -140,6 +248,7 @@ void Assembly<nlayer>::updateGeometry()
 template <int nlayer>
 void Assembly<nlayer>::storeStateVar()
 {
+#pragma omp parallel for
     for (Particle<nlayer> *pt : pt_sys)
     {
         pt->xyz_last = pt->xyz;
@@ -150,6 +259,7 @@ void Assembly<nlayer>::storeStateVar()
 template <int nlayer>
 void Assembly<nlayer>::resetStateVar(bool reset_xyz)
 {
+#pragma omp parallel for
     for (Particle<nlayer> *pt : pt_sys)
     {
         if (reset_xyz)
@@ -161,81 +271,187 @@ void Assembly<nlayer>::resetStateVar(bool reset_xyz)
 template <int nlayer>
 void Assembly<nlayer>::updateStateVar()
 {
-    for (Particle<nlayer> *pt : pt_sys)
-        pt->updateParticleStateVariables();
+    arena.forEach([](auto &pt)
+                  { pt.updateParticleStateVariables(); });
 }
 
 template <int nlayer>
 bool Assembly<nlayer>::updateBrokenBonds()
 {
-    bool any_broken{false};
-    for (Particle<nlayer> *pt : pt_sys)
-        any_broken = pt->updateParticleBrokenBonds() || any_broken;
-
-    return any_broken;
+    return arena.forEachAny([](auto &pt)
+                            { return pt.updateParticleBrokenBonds(); });
 }
 
 template <int nlayer>
 void Assembly<nlayer>::updateForceState()
 {
     // this function should be after the geometry updating (ie., above function)
+    // each particle only writes its own bonds, and reads the particle damage that is not changed in this pass
+    arena.forEach([](auto &pt)
+                  { pt.updateBondsForce(); });
+
+    // the opposite bond forces are only read after all bond forces are updated
+#pragma omp parallel for
     for (Particle<nlayer> *pt : pt_sys)
-        pt->updateBondsForce();
+        pt->updateParticleForceStress();
+}
 
+template <int nlayer>
+void Assembly<nlayer>::updateGeometryForceState()
+{
+    // sweep 1: geometry and then force of the bonds of each particle, while they are still in cache
+    // the bond force only needs the geometry sums of its own particle and the (unchanged) particle damage
+    arena.forEach([](auto &pt)
+                  {
+                      pt.updateBondsGeometry();
+                      pt.updateBondsForce(); });
+
+    // sweep 2: particle force, stress and damage, once all bond forces (incl. the opposite ones) are known
+#pragma omp parallel for
     for (Particle<nlayer> *pt : pt_sys)
+        pt->updateParticleForceStress();
+}
+
+template <int nlayer>
+void Assembly<nlayer>::createParticles(std::vector<std::array<double, NDIM>> &p_xyz, UnitCell &p_cell, const ReorderMode &p_reorder)
+{
+    // particles are created (and numbered) in the new order, so the arena, pt_sys and the bonds follow it
+    std::vector<int> order = particleOrder(p_reorder, p_xyz, 1.01 * p_cell.neighbor_cutoff[1]);
+
+    arena.reserve(ptype, p_xyz.size());
+    for (int i : order)
     {
-        pt->updateParticleForce();
-        pt->updateParticleStress();
-        pt->updateParticleDamageVisual();
+        Particle<nlayer> *pt = arena.create(ptype, p_xyz[i][0], p_xyz[i][1], p_xyz[i][2], p_cell);
+        pt_sys.push_back(pt);
     }
+
+    // id_initial is the id the particle gets without reordering
+    for (int n = 0; n < (int)pt_sys.size(); ++n)
+        pt_sys[n]->id_initial = pt_sys[0]->id + order[n];
 }
 
 template <int nlayer>
-void Assembly<nlayer>::createParticles(std::vector<std::array<double, NDIM>> &p_xyz, UnitCell &p_cell)
+void Assembly<nlayer>::createBonds()
 {
-    for (auto xyz : p_xyz)
+    double t1 = omp_get_wtime();
+
+    // bin the particles into cells no smaller than the largest bond length
+    std::vector<std::array<double, NDIM>> xyz_sys;
+    for (Particle<nlayer> *pt : pt_sys)
+        xyz_sys.push_back(pt->xyz);
+
+    double cutoff = 1.01 * pt_sys[0]->cell.neighbor_cutoff[1];
+    CellList cells(xyz_sys, cutoff);
+
+    // count the bonds of each particle in each layer, then fill them into the bond store at fixed offsets
+    std::vector<std::array<int, nlayer>> nbonds(pt_sys.size());
+#pragma omp parallel
     {
-        Particle<nlayer> *pt = nullptr;
-        if (ptype == ParticleType::Elastic)
-            pt = new ParticleElastic<nlayer>(xyz[0], xyz[1], xyz[2], p_cell);
-        if (ptype == ParticleType::ElasticDamage)
-            pt = new ParticleElasticDamage<nlayer>(xyz[0], xyz[1], xyz[2], p_cell);
-        if (ptype == ParticleType::J2Plasticity)
-            pt = new ParticleJ2Plasticity<nlayer>(xyz[0], xyz[1], xyz[2], p_cell);
-        if (ptype == ParticleType::FatigueHCF)
-            pt = new ParticleFatigueHCF<nlayer>(xyz[0], xyz[1], xyz[2], p_cell);
+        std::vector<int> candidates; // particles in the surrounding cells
+#pragma omp for
+        for (int n = 0; n < (int)pt_sys.size(); ++n)
+        {
+            Particle<nlayer> *p1 = pt_sys[n];
+            nbonds[n].fill(0);
+            cells.findCandidates(p1->xyz, cutoff, candidates);
+            for (int j : candidates)
+            {
+                Particle<nlayer> *p2 = pt_sys[j];
+                double distance = p1->distanceTo(p2);
+                if ((distance < 1.01 * p1->cell.neighbor_cutoff[1]) && (p1->id != p2->id))
+                    ++nbonds[n][(distance < 1.01 * p1->cell.neighbor_cutoff[0]) ? 0 : 1];
+            }
+        }
+    }
 
-        pt_sys.push_back(pt);
+    allocateBonds(nbonds);
+
+#pragma omp parallel
+    {
+        std::vector<int> candidates;
+#pragma omp for
+        for (Particle<nlayer> *p1 : pt_sys)
+        {
+            std::array<int, nlayer> next;
+            for (int i = 0; i < nlayer; ++i)
+                next[i] = p1->bond_ptr[i];
+
+            cells.findCandidates(p1->xyz, cutoff, candidates);
+            for (int j : candidates)
+            {
+                Particle<nlayer> *p2 = pt_sys[j];
+                double distance = p1->distanceTo(p2);
+                if ((distance < 1.01 * p1->cell.neighbor_cutoff[1]) && (p1->id != p2->id))
+                {
+                    int layer = 1;
+                    if (distance < 1.01 * p1->cell.neighbor_cutoff[0])
+                        layer = 0;
+
+                    bonds->setBond(next[layer]++, p1, p2, distance); // create bonds
+                    p1->neighbors.push_back(p2);
+                }
+            }
+            p1->nb = p1->neighbors.size();
+        }
     }
+
+    linkOppositeBonds();
+
+    double t2 = omp_get_wtime();
+    printf("Bond creation costs %f seconds\n", t2 - t1);
 }
 
 template <int nlayer>
-void Assembly<nlayer>::createBonds()
+void Assembly<nlayer>::allocateBonds(const std::vector<std::array<int, nlayer>> &nbonds)
+{
+    // lay out the bonds particle by particle and layer by layer, nbonds is indexed like pt_sys
+    int nbond = 0;
+    for (int n = 0; n < (int)pt_sys.size(); ++n)
+    {
+        for (int i = 0; i < nlayer; ++i)
+        {
+            pt_sys[n]->bond_ptr[i] = nbond;
+            nbond += nbonds[n][i];
+        }
+        pt_sys[n]->bond_ptr[nlayer] = nbond;
+    }
+
+    bonds = new BondStore<nlayer>(nbond);
+    for (Particle<nlayer> *pt : pt_sys)
+        pt->bonds = bonds;
+}
+
+template <int nlayer>
+void Assembly<nlayer>::linkOppositeBonds()
 {
+    BondStore<nlayer> &bs = *bonds;
+
+    // bonds are symmetric, each bond stores its opposite bond so that the force kernels need no search
 #pragma omp parallel for
     for (Particle<nlayer> *p1 : pt_sys)
     {
-        for (Particle<nlayer> *p2 : pt_sys)
+        for (int i = 0; i < nlayer; ++i)
         {
-            double distance = p1->distanceTo(p2);
-            if ((distance < 1.01 * p1->cell.neighbor_cutoff[1]) && (p1->id != p2->id))
+            for (int bd = p1->bond_ptr[i]; bd < p1->bond_ptr[i + 1]; ++bd)
             {
-                int layer = 1;
-                if (distance < 1.01 * p1->cell.neighbor_cutoff[0])
-                    layer = 0;
-
-                Bond<nlayer> *bd = new Bond<nlayer>(p1, p2, layer, distance); // create bonds
-                p1->bond_layers[layer].push_back(bd);
-                p1->neighbors.push_back(p2);
+                for (int bd_op = bs.p2[bd]->bond_ptr[i]; bd_op < bs.p2[bd]->bond_ptr[i + 1]; ++bd_op)
+                {
+                    if (bs.p2[bd_op] == p1)
+                    {
+                        bs.op[bd] = bd_op;
+                        break;
+                    }
+                }
             }
         }
-        p1->nb = p1->neighbors.size();
     }
 }
 
 template <int nlayer>
 void Assembly<nlayer>::updateConnections()
 {
+    BondStore<nlayer> &bs = *bonds;
+
 #pragma omp parallel for
     for (Particle<nlayer> *p1 : pt_sys)
     {
@@ -243,42 +459,89 @@ void Assembly<nlayer>::updateConnections()
         for (int i = 0; i < nlayer; i++)
         {
             // loop forward bond particles
-            for (auto *bd_fw : p1->bond_layers[i])
+            for (int bd_fw = p1->bond_ptr[i]; bd_fw < p1->bond_ptr[i + 1]; ++bd_fw)
             {
-                p1->conns.push_back(bd_fw->p2);
+                p1->conns.push_back(bs.p2[bd_fw]);
 
                 // loop backward bond particles
-                for (auto *bd_bw : bd_fw->p2->bond_layers[i])
+                for (int bd_bw = bs.p2[bd_fw]->bond_ptr[i]; bd_bw < bs.p2[bd_fw]->bond_ptr[i + 1]; ++bd_bw)
                 {
-                    p1->conns.push_back(bd_bw->p2);
+                    p1->conns.push_back(bs.p2[bd_bw]);
                 }
             }
         }
         std::sort(p1->conns.begin(), p1->conns.end(), [](Particle<nlayer> *a, Particle<nlayer> *b)
                   { return a->id < b->id; });
         p1->conns.erase(unique(p1->conns.begin(), p1->conns.end()), p1->conns.end());
+    }
+
+    if (wide_conns)
+    {
+        // the conns of the bonded neighbors and the bonded neighbors of the conns, which keeps the lists symmetric
+        std::vector<std::vector<Particle<nlayer> *>> conns_wide(pt_sys.size());
+#pragma omp parallel for
+        for (Particle<nlayer> *p1 : pt_sys)
+        {
+            std::vector<Particle<nlayer> *> &cw = conns_wide[p1->id];
+            cw = p1->conns;
+            for (int bd = p1->bond_ptr[0]; bd < p1->bond_ptr[nlayer]; ++bd)
+                cw.insert(cw.end(), bs.p2[bd]->conns.begin(), bs.p2[bd]->conns.end());
+            for (Particle<nlayer> *pk : p1->conns)
+            {
+                for (int bd = pk->bond_ptr[0]; bd < pk->bond_ptr[nlayer]; ++bd)
+                    cw.push_back(bs.p2[bd]);
+            }
+            std::sort(cw.begin(), cw.end(), [](Particle<nlayer> *a, Particle<nlayer> *b)
+                      { return a->id < b->id; });
+            cw.erase(unique(cw.begin(), cw.end()), cw.end());
+        }
+
+#pragma omp parallel for
+        for (Particle<nlayer> *p1 : pt_sys)
+            p1->conns.swap(conns_wide[p1->id]);
+    }
+
+#pragma omp parallel for
+    for (Particle<nlayer> *p1 : pt_sys)
+    {
         p1->nconn = p1->conns.size();
 
         // get the number of conns with id larger or equal to self
         auto curr = std::find(p1->conns.begin(), p1->conns.end(), p1);
         p1->nconn_largeq = (int)std::distance(curr, p1->conns.end());
     }
+
+    // transposed positions, conns are symmetric and sorted by id
+#pragma omp parallel for
+    for (Particle<nlayer> *p1 : pt_sys)
+    {
+        p1->conn_slot.resize(p1->nconn);
+        for (int k = 0; k < p1->nconn; ++k)
+        {
+            std::vector<Particle<nlayer> *> &conns2 = p1->conns[k]->conns;
+            auto pt = std::lower_bound(conns2.begin(), conns2.end(), p1, [](Particle<nlayer> *a, Particle<nlayer> *b)
+                                       { return a->id < b->id; });
+            p1->conn_slot[k] = (int)std::distance(conns2.begin(), pt);
+        }
+    }
 }
 
 template <int nlayer>
 void Assembly<nlayer>::writeBond(const std::string &bondFile)
 {
     // please note that the bond has directionality, i.e., bond_12 != bond_21
+    BondStore<nlayer> &bs = *bonds;
 
     FILE *fpt = fopen(bondFile.c_str(), "w+");
     for (Particle<nlayer> *pt : pt_sys)
     {
         for (int i = 0; i < nlayer; ++i)
         {
-            for (Bond<nlayer> *bd : pt->bond_layers[i])
-                fprintf(fpt, "%d %d %d %d\n", bd->id, bd->layer, bd->p1->id, bd->p2->id);
+            for (int bd = pt->bond_ptr[i]; bd < pt->bond_ptr[i + 1]; ++bd)
+                fprintf(fpt, "%d %d %d %d\n", bd, i, pt->id_initial, bs.p2[bd]->id_initial);
         }
     }
+    fclose(fpt);
 }
 
 template <int nlayer>
@@ -299,7 +562,7 @@ void Assembly<nlayer>::writeConfigurationDump(const std::string &dumpFile)
     for (auto pt : pt_sys)
     {
         fprintf(fpt, "%d %d %.4e %.4e %.4e \n",
-                pt->id, pt->type,
+                pt->id_initial, pt->type,
                 pt->xyz[0], pt->xyz[1], pt->xyz[2]);
     }
 
@@ -324,7 +587,7 @@ void Assembly<nlayer>::writeDump(const std::string &dumpFile, int step)
     for (auto pt : pt_sys)
     {
         fprintf(fpt, "%d %d %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e %.4e\n",
-                pt->id, pt->type,
+                pt->id_initial, pt->type,
                 pt->xyz[0], pt->xyz[1], pt->xyz[2],
                 pt->xyz[0] - pt->xyz_initial[0], pt->xyz[1] - pt->xyz_initial[1], pt->xyz[2] - pt->xyz_initial[2],
                 pt->stress[0], pt->stress[1], pt->stress[2], pt->stress[3], pt->stress[4], pt->stress[5], pt->damage, pt->damage_visual,
@@ -335,7 +598,7 @@ void Assembly<nlayer>::writeDump(const std::string &dumpFile, int step)
 }
 
 template <int nlayer>
-void Assembly<nlayer>::readDump(const std::string &dumpFile, UnitCell &cell)
+void Assembly<nlayer>::readDump(const std::string &dumpFile, UnitCell &cell, const ReorderMode &p_reorder)
 {
     // Only support dump data type: particle id, type, x, y, z
     // Please note that the particle id needs to start from 0
@@ -366,25 +629,31 @@ void Assembly<nlayer>::readDump(const std::string &dumpFile, UnitCell &cell)
     tmp = fgets(line, MAXLENGTH, fpt);
 
     /* store into position variable xyz */
+    std::vector<int> ids, types;
+    std::vector<std::array<double, NDIM>> xyzs;
     int id, type;
-    double xyz[NDIM];
+    std::array<double, NDIM> xyz;
     while (fscanf(fpt, "%d %d %lf %lf %lf", &(id), &(type), &(xyz[0]), &(xyz[1]), &(xyz[2])) > 0)
     {
-        Particle<nlayer> *pt = nullptr;
-        if (ptype == ParticleType::Elastic)
-            pt = new ParticleElastic<nlayer>(xyz[0], xyz[1], xyz[2], cell, type);
-        if (ptype == ParticleType::ElasticDamage)
-            pt = new ParticleElasticDamage<nlayer>(xyz[0], xyz[1], xyz[2], cell, type);
-        if (ptype == ParticleType::J2Plasticity)
-            pt = new ParticleJ2Plasticity<nlayer>(xyz[0], xyz[1], xyz[2], cell, type);
-        if (ptype == ParticleType::FatigueHCF)
-            pt = new ParticleFatigueHCF<nlayer>(xyz[0], xyz[1], xyz[2], cell, type);
-
-        pt->id = id;
-        pt_sys.push_back(pt);
+        ids.push_back(id);
+        types.push_back(type);
+        xyzs.push_back(xyz);
     }
 
     fclose(fpt);
+
+    // a reordered system is numbered from 0 in the new order, the id of the dump file is kept as id_initial
+    std::vector<int> order = particleOrder(p_reorder, xyzs, 1.01 * cell.neighbor_cutoff[1]);
+
+    arena.reserve(ptype, (int)xyzs.size());
+    for (int n = 0; n < (int)order.size(); ++n)
+    {
+        int i = order[n];
+        Particle<nlayer> *pt = arena.create(ptype, xyzs[i][0], xyzs[i][1], xyzs[i][2], cell, types[i]);
+        pt->id = (p_reorder == ReorderMode::None) ? ids[i] : n;
+        pt->id_initial = ids[i];
+        pt_sys.push_back(pt);
+    }
 }
 
 template <int nlayer>
@@ -399,28 +668,45 @@ void Assembly<nlayer>::readBond(const std::string &bondFile)
         exit(1);
     }
 
-    std::map<int, Particle<nlayer> *> pt_map = toMap();
+    double t1 = omp_get_wtime();
+    // index of each particle in pt_sys, the bond file refers to the input ids
+    std::map<int, int> pt_index;
+    for (int n = 0; n < (int)pt_sys.size(); ++n)
+        pt_index[pt_sys[n]->id_initial] = n;
 
+    // read all bonds first, they are counted per particle and layer before being filled into the bond store
+    std::vector<std::array<int, 3>> bond_list; // layer, p1 index, p2 index
     int id, layer, p1id, p2id;
     while (fscanf(fpt, "%d %d %d %d", &(id), &(layer), &(p1id), &(p2id)) == 4)
-    {
-        // find the two particles
-        auto p1 = pt_map[p1id];
-        auto p2 = pt_map[p2id];
+        bond_list.push_back({layer, pt_index[p1id], pt_index[p2id]});
 
-        // auto p1 = std::find_if(pt_set.begin(), pt_set.end(), [&](const Particle<nlayer> *p)
-        //                        { return p->id == p1id; });
-        // auto p2 = std::find_if(pt_set.begin(), pt_set.end(), [&](const Particle<nlayer> *p)
-        //                        { return p->id == p2id; });
+    std::vector<std::array<int, nlayer>> nbonds(pt_sys.size());
+    for (std::array<int, nlayer> &nb : nbonds)
+        nb.fill(0);
+    for (const std::array<int, 3> &b : bond_list)
+        ++nbonds[b[1]][b[0]];
 
-        double distance = p1->distanceTo(p2);
-        Bond<nlayer> *bd = new Bond<nlayer>(p1, p2, layer, distance); // create bonds
+    allocateBonds(nbonds);
+
+    std::vector<std::array<int, nlayer>> next(pt_sys.size());
+    for (int n = 0; n < (int)pt_sys.size(); ++n)
+        std::copy(pt_sys[n]->bond_ptr.begin(), pt_sys[n]->bond_ptr.begin() + nlayer, next[n].begin());
 
-        p1->bond_layers[layer].push_back(bd);
+    for (const std::array<int, 3> &b : bond_list)
+    {
+        Particle<nlayer> *p1 = pt_sys[b[1]];
+        Particle<nlayer> *p2 = pt_sys[b[2]];
+        double distance = p1->distanceTo(p2);
+        bonds->setBond(next[b[1]][b[0]]++, p1, p2, distance); // create bonds
         p1->neighbors.push_back(p2);
     }
 
     fclose(fpt);
+
+    linkOppositeBonds();
+
+    double t2 = omp_get_wtime();
+    printf("Bond reading costs %f seconds\n", t2 - t1);
 }
 
 #endif
\ No newline at end of file
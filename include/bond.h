@@ -2,77 +2,109 @@
 #ifndef BOND_H
 #define BOND_H
 
+#include <vector>
+
 #include "lpm.h"
 #include "unit_cell.h"
+#include "bond_kernel.h"
 #include "particle.h"
 
 template <int nlayer>
 class Particle;
 
+// All bonds of a particle system stored as structure of arrays
+// Bonds are grouped by their owner particle (p1) and then by layer, i.e., the bonds of particle p1 in layer i
+// are [p1->bond_ptr[i], p1->bond_ptr[i + 1]), so the per-particle loops stream through contiguous memory
+// The index of a bond in the store is also its identifier
+
 template <int nlayer>
-class Bond
+class BondStore
 {
-protected:
-    static int _ID;
+public:
+    int nbond{0};                                                   // total number of bonds
+    std::vector<Particle<nlayer> *> p2;                             // the other particle of each bond (not owned by the bond)
+    std::vector<int> op;                                            // index of the opposite bond (from p2 to p1)
+    std::vector<double> dis_initial, dis_last, dis;                 // initial, last, and current bond length
+    std::vector<double> dLe, dLp, dLp_last;                         // elastic and plastic bond change
+    std::vector<double> bstrain;                                    // bond strain
+    std::vector<double> Kn, Tv;                                     // LPM coefficient
+    std::vector<double> csx, csy, csz;                              // direction cosine
+    std::vector<double> bforce_last, bforce, bdamage, bdamage_last; // bond-wise quantities
+
+    BondStore(int p_nbond);
 
+    void setBond(int k, Particle<nlayer> *p_p1, Particle<nlayer> *p_p2, double p_dis);
+    void updateGeometry(int b0, int b1, Particle<nlayer> *p_p1); // bonds [b0, b1) of particle p_p1
+    void updateForce(int b0, int b1, double dLe_total);           // bonds [b0, b1) of one layer, bdamage already updated
+};
+
+// Derivatives of the bond quantities with respect to the seeded particle coordinates, indexed like the bond store
+// (forward-mode automatic differentiation, the values themselves are read from the bond store)
+
+template <int nlayer>
+class BondTangent
+{
 public:
-    int id{0};                                                     // identifier of the bond, id starts from 0
-    int layer{-1};                                                 // index of current bond layer
-    double dis_initial{0}, dis_last{0}, dis{0};                    // initial, last, and current bond length
-    double dL{0}, dLe{0}, dLp{0}, dLp_last{0};                     // total, elastic and plastic bond change
-    double dLe_dis{0};                                             // distortional bond stretch
-    double bstrain{0};                                             // bond strain
-    double Kn{0}, Tv{0};                                           // LPM coefficient
-    double csx{0}, csy{0}, csz{0};                                 // direction cosine
-    double bforce_last{0}, bforce{0}, bdamage{0}, bdamage_last{0}; // bond-wise quantities
-    Particle<nlayer> *p1, *p2;                                     // particles are not owned by the bond (only store the location)
-
-    void updatebGeometry()
-    {
-        dis = p1->distanceTo(p2);
-        dL = (abs(bdamage - 1.0) < EPS) ? 0.0 : (dis - dis_initial);
-        bstrain = (abs(bdamage - 1.0) < EPS) ? 0.0 : (dL / dis);
-        dLe = (abs(bdamage - 1.0) < EPS) ? 0.0 : (dis - dis_initial - dLp);
-        csx = (abs(bdamage - 1.0) < EPS) ? 0.0 : ((p1->xyz[0] - p2->xyz[0]) / dis);
-        csy = (abs(bdamage - 1.0) < EPS) ? 0.0 : ((p1->xyz[1] - p2->xyz[1]) / dis);
-        csz = (abs(bdamage - 1.0) < EPS) ? 0.0 : ((p1->xyz[2] - p2->xyz[2]) / dis);
-    }
+    std::vector<double> dLe, csx, csy, csz, bforce; // derivative of the elastic stretch, direction cosines and bond force
 
-    Bond(Particle<nlayer> *p_p1, Particle<nlayer> *p_p2)
-    {
-        id = _ID++;
-        p1 = p_p1;
-        p2 = p_p2;
-        dis = p1->distanceTo(p2);
-        dis_initial = dis;
-        dis_last = dis;
-        if ((dis < 1.01 * p1->cell.neighbor_cutoff[0]) && (p1->id != p2->id))
-            layer = 0;
-        else if ((dis > 1.01 * p1->cell.neighbor_cutoff[0]) && (dis < 1.01 * p1->cell.neighbor_cutoff[1]))
-            layer = 1;
-
-        csx = (p1->xyz[0] - p2->xyz[0]) / dis;
-        csy = (p1->xyz[1] - p2->xyz[1]) / dis;
-        csz = (p1->xyz[2] - p2->xyz[2]) / dis;
-    }
+    void resize(int p_nbond);
+};
 
-    Bond(Particle<nlayer> *p_p1, Particle<nlayer> *p_p2, int p_layer, double p_dis)
+template <int nlayer>
+void BondTangent<nlayer>::resize(int p_nbond)
+{
+    for (std::vector<double> *v : {&dLe, &csx, &csy, &csz, &bforce})
+        v->resize(p_nbond, 0.0);
+}
+
+template <int nlayer>
+BondStore<nlayer>::BondStore(int p_nbond)
+{
+    nbond = p_nbond;
+    p2 = std::vector<Particle<nlayer> *>(nbond, nullptr);
+    op = std::vector<int>(nbond, -1);
+    for (std::vector<double> *v : {&dis_initial, &dis_last, &dis, &dLe, &dLp, &dLp_last, &bstrain, &Kn, &Tv,
+                                   &csx, &csy, &csz, &bforce_last, &bforce, &bdamage, &bdamage_last})
+        *v = std::vector<double>(nbond, 0.0);
+}
+
+template <int nlayer>
+void BondStore<nlayer>::setBond(int k, Particle<nlayer> *p_p1, Particle<nlayer> *p_p2, double p_dis)
+{
+    p2[k] = p_p2;
+    dis[k] = p_dis;
+    dis_initial[k] = p_dis;
+    dis_last[k] = p_dis;
+
+    csx[k] = (p_p1->xyz[0] - p_p2->xyz[0]) / p_dis;
+    csy[k] = (p_p1->xyz[1] - p_p2->xyz[1]) / p_dis;
+    csz[k] = (p_p1->xyz[2] - p_p2->xyz[2]) / p_dis;
+}
+
+template <int nlayer>
+void BondStore<nlayer>::updateGeometry(int b0, int b1, Particle<nlayer> *p_p1)
+{
+    // gather the coordinates of the other particles into contiguous chunks for the vectorized kernel
+    const int chunk = 64;
+    double xyz2[NDIM][chunk];
+    for (int c0 = b0; c0 < b1; c0 += chunk)
     {
-        id = _ID++;
-        p1 = p_p1;
-        p2 = p_p2;
-        dis = p_dis;
-        dis_initial = p_dis;
-        dis_last = dis;
-        layer = p_layer;
-
-        csx = (p1->xyz[0] - p2->xyz[0]) / dis;
-        csy = (p1->xyz[1] - p2->xyz[1]) / dis;
-        csz = (p1->xyz[2] - p2->xyz[2]) / dis;
+        int n = std::min(chunk, b1 - c0);
+        for (int k = 0; k < n; ++k)
+        {
+            for (int d = 0; d < NDIM; ++d)
+                xyz2[d][k] = p2[c0 + k]->xyz[d];
+        }
+
+        bondGeometryKernel(n, p_p1->xyz.data(), xyz2[0], xyz2[1], xyz2[2], &dis_initial[c0], &dLp[c0], &bdamage[c0],
+                           &dis[c0], &bstrain[c0], &dLe[c0], &csx[c0], &csy[c0], &csz[c0]);
     }
-};
+}
 
 template <int nlayer>
-int Bond<nlayer>::_ID = 0;
+void BondStore<nlayer>::updateForce(int b0, int b1, double dLe_total)
+{
+    bondForceKernel(b1 - b0, &Kn[b0], &Tv[b0], &dLe[b0], dLe_total, &bdamage[b0], &bforce[b0]);
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,194 @@
+#pragma once
+#ifndef BOND_KERNEL_H
+#define BOND_KERNEL_H
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+#include "lpm.h"
+#include "dual.h"
+
+// Bond kernels over a contiguous range of bonds of the bond store (structure of arrays)
+// Each kernel has one per-bond body that is looped over as plain scalar code and, on x86 with GCC or Clang, as
+// `omp simd` loops compiled for AVX2 and AVX-512, the variant is selected at runtime. Broken bonds are handled with masks instead of branches.
+// Floating-point contraction is disabled, so every variant computes exactly the same operations as the scalar loop
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LPM_X86_DISPATCH
+#define LPM_ALWAYS_INLINE inline __attribute__((always_inline))
+#define LPM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LPM_ALWAYS_INLINE inline
+#endif
+
+SimdMode bond_kernel_mode = SimdMode::Auto; // how the bond kernels are executed, SimdMode::Verify is a test mode
+
+SimdISA detectSimdISA()
+{
+#ifdef LPM_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdISA::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdISA::AVX2;
+#endif
+    return SimdISA::Scalar;
+}
+
+const SimdISA bond_kernel_isa = detectSimdISA(); // best instruction set of the cpu
+
+#ifdef LPM_X86_DISPATCH
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off", "no-tree-sink") // no sinking of loads into the unbroken branch, it would block the if-conversion
+#endif
+
+// bond length, bond strain, elastic stretch and direction cosines of bond k, x1 is the owner particle
+// T is double, or Dual for the tangent of the coordinates (stiffness by automatic differentiation)
+template <typename T>
+LPM_ALWAYS_INLINE void bondGeometryOne(int k, const T *x1, const T *x2, const T *y2, const T *z2,
+                                       const double *dis_initial, const double *dLp, const double *bdamage,
+                                       T *dis, T *bstrain, T *dLe, T *csx, T *csy, T *csz)
+{
+    T dx = x1[0] - x2[k], dy = x1[1] - y2[k], dz = x1[2] - z2[k];
+    T d = sqrt(dx * dx + dy * dy + dz * dz);
+    double db = bdamage[k] - 1.0;
+    bool broken = fabs(db) < EPS;
+    T strain = (d - dis_initial[k]) / d, dle = d - dis_initial[k] - dLp[k];
+    T cx = dx / d, cy = dy / d, cz = dz / d; // evaluated for every bond, broken ones are masked below
+    dis[k] = d;
+    bstrain[k] = broken ? 0.0 : strain;
+    dLe[k] = broken ? 0.0 : dle;
+    csx[k] = broken ? 0.0 : cx;
+    csy[k] = broken ? 0.0 : cy;
+    csz[k] = broken ? 0.0 : cz;
+}
+
+// damaged force of bond k, (2 * Kn * dLe + 2 * Tv * dLe_total) * (1 - bdamage), bdamage has to be updated before
+template <typename T>
+LPM_ALWAYS_INLINE void bondForceOne(int k, const double *Kn, const double *Tv, const T *dLe, T dLe_total,
+                                    const double *bdamage, T *bforce)
+{
+    bforce[k] = (2. * Kn[k] * dLe[k] + 2. * Tv[k] * dLe_total) * (1.0 - bdamage[k]);
+}
+
+void bondGeometryScalar(int n, const double *x1, const double *x2, const double *y2, const double *z2, const double *dis_initial, const double *dLp, const double *bdamage,
+                        double *dis, double *bstrain, double *dLe, double *csx, double *csy, double *csz)
+{
+    for (int k = 0; k < n; ++k)
+        bondGeometryOne(k, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+}
+
+void bondForceScalar(int n, const double *Kn, const double *Tv, const double *dLe, double dLe_total, const double *bdamage, double *bforce)
+{
+    for (int k = 0; k < n; ++k)
+        bondForceOne(k, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+}
+
+#ifdef LPM_X86_DISPATCH
+LPM_TARGET("avx2")
+void bondGeometryAVX2(int n, const double *x1, const double *x2, const double *y2, const double *z2, const double *dis_initial, const double *dLp, const double *bdamage,
+                      double *dis, double *bstrain, double *dLe, double *csx, double *csy, double *csz)
+{
+#pragma omp simd
+    for (int k = 0; k < n; ++k)
+        bondGeometryOne(k, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+}
+
+LPM_TARGET("avx2")
+void bondForceAVX2(int n, const double *Kn, const double *Tv, const double *dLe, double dLe_total, const double *bdamage, double *bforce)
+{
+#pragma omp simd
+    for (int k = 0; k < n; ++k)
+        bondForceOne(k, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+}
+
+LPM_TARGET("avx512f")
+void bondGeometryAVX512(int n, const double *x1, const double *x2, const double *y2, const double *z2, const double *dis_initial, const double *dLp, const double *bdamage,
+                        double *dis, double *bstrain, double *dLe, double *csx, double *csy, double *csz)
+{
+#pragma omp simd
+    for (int k = 0; k < n; ++k)
+        bondGeometryOne(k, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+}
+
+LPM_TARGET("avx512f")
+void bondForceAVX512(int n, const double *Kn, const double *Tv, const double *dLe, double dLe_total, const double *bdamage, double *bforce)
+{
+#pragma omp simd
+    for (int k = 0; k < n; ++k)
+        bondForceOne(k, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+}
+#endif
+
+#ifdef LPM_X86_DISPATCH
+#pragma GCC pop_options
+#endif
+
+void bondGeometryBest(int n, const double *x1, const double *x2, const double *y2, const double *z2, const double *dis_initial, const double *dLp, const double *bdamage,
+                      double *dis, double *bstrain, double *dLe, double *csx, double *csy, double *csz)
+{
+#ifdef LPM_X86_DISPATCH
+    if (bond_kernel_isa == SimdISA::AVX512)
+        return bondGeometryAVX512(n, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+    if (bond_kernel_isa == SimdISA::AVX2)
+        return bondGeometryAVX2(n, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+#endif
+    bondGeometryScalar(n, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+}
+
+void bondForceBest(int n, const double *Kn, const double *Tv, const double *dLe, double dLe_total, const double *bdamage, double *bforce)
+{
+#ifdef LPM_X86_DISPATCH
+    if (bond_kernel_isa == SimdISA::AVX512)
+        return bondForceAVX512(n, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+    if (bond_kernel_isa == SimdISA::AVX2)
+        return bondForceAVX2(n, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+#endif
+    bondForceScalar(n, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+}
+
+void reportSimdMismatch(const char *kernel, int n, const std::vector<const double *> &simd, const std::vector<std::vector<double>> &scalar)
+{
+    for (int j = 0; j < (int)simd.size(); ++j)
+    {
+        if (memcmp(simd[j], scalar[j].data(), n * sizeof(double)) != 0)
+        {
+            printf("%s: vectorized result differs from the scalar loop (output %d)\n", kernel, j);
+            exit(1);
+        }
+    }
+}
+
+void bondGeometryKernel(int n, const double *x1, const double *x2, const double *y2, const double *z2, const double *dis_initial, const double *dLp, const double *bdamage,
+                        double *dis, double *bstrain, double *dLe, double *csx, double *csy, double *csz)
+{
+    if (bond_kernel_mode == SimdMode::Scalar)
+        return bondGeometryScalar(n, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+
+    bondGeometryBest(n, x1, x2, y2, z2, dis_initial, dLp, bdamage, dis, bstrain, dLe, csx, csy, csz);
+
+    if (bond_kernel_mode == SimdMode::Verify)
+    {
+        std::vector<std::vector<double>> ref(6, std::vector<double>(n));
+        bondGeometryScalar(n, x1, x2, y2, z2, dis_initial, dLp, bdamage, ref[0].data(), ref[1].data(), ref[2].data(), ref[3].data(), ref[4].data(), ref[5].data());
+        reportSimdMismatch("bondGeometryKernel", n, {dis, bstrain, dLe, csx, csy, csz}, ref);
+    }
+}
+
+void bondForceKernel(int n, const double *Kn, const double *Tv, const double *dLe, double dLe_total, const double *bdamage, double *bforce)
+{
+    if (bond_kernel_mode == SimdMode::Scalar)
+        return bondForceScalar(n, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+
+    bondForceBest(n, Kn, Tv, dLe, dLe_total, bdamage, bforce);
+
+    if (bond_kernel_mode == SimdMode::Verify)
+    {
+        std::vector<std::vector<double>> ref(1, std::vector<double>(n));
+        bondForceScalar(n, Kn, Tv, dLe, dLe_total, bdamage, ref[0].data());
+        reportSimdMismatch("bondForceKernel", n, {bforce}, ref);
+    }
+}
+
+#endif
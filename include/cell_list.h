@@ -0,0 +1,106 @@
+#pragma once
+#ifndef CELL_LIST_H
+#define CELL_LIST_H
+
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include "lpm.h"
+
+// Uniform grid (cell list) that bins a set of points so that all points within a radius of a
+// location can be found by only visiting the surrounding cells, i.e., O(1) per query
+
+class CellList
+{
+public:
+    double cell_size{0};               // edge length of a cubic cell
+    std::array<double, NDIM> lower;    // lower corner of the binned region
+    std::array<int, NDIM> ncell;       // number of cells along each direction
+    std::vector<int> cell_start;       // start index of each cell in cell_items (CSR pointer)
+    std::vector<int> cell_items;       // point indices grouped by cell, ascending inside each cell
+
+    CellList(const std::vector<std::array<double, NDIM>> &p_xyz, double p_cell_size);
+
+    int cellCoord(double x, int d) const;
+    void findCandidates(const std::array<double, NDIM> &x, double radius, std::vector<int> &candidates) const;
+};
+
+CellList::CellList(const std::vector<std::array<double, NDIM>> &p_xyz, double p_cell_size)
+{
+    cell_size = p_cell_size;
+
+    // bounding box of all points
+    std::array<double, NDIM> upper;
+    lower = p_xyz[0];
+    upper = p_xyz[0];
+    for (const std::array<double, NDIM> &x : p_xyz)
+    {
+        for (int d = 0; d < NDIM; ++d)
+        {
+            lower[d] = std::min(lower[d], x[d]);
+            upper[d] = std::max(upper[d], x[d]);
+        }
+    }
+
+    int ncell_total = 1;
+    for (int d = 0; d < NDIM; ++d)
+    {
+        ncell[d] = (int)floor((upper[d] - lower[d]) / cell_size) + 1;
+        ncell_total *= ncell[d];
+    }
+
+    // counting sort of the points into cells, the point order is kept inside each cell
+    std::vector<int> cell_of(p_xyz.size());
+    cell_start = std::vector<int>(ncell_total + 1, 0);
+    for (int i = 0; i < (int)p_xyz.size(); ++i)
+    {
+        const std::array<double, NDIM> &x = p_xyz[i];
+        cell_of[i] = (cellCoord(x[2], 2) * ncell[1] + cellCoord(x[1], 1)) * ncell[0] + cellCoord(x[0], 0);
+        ++cell_start[cell_of[i] + 1];
+    }
+
+    for (int c = 0; c < ncell_total; ++c)
+        cell_start[c + 1] += cell_start[c];
+
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    cell_items = std::vector<int>(p_xyz.size());
+    for (int i = 0; i < (int)p_xyz.size(); ++i)
+        cell_items[fill[cell_of[i]]++] = i;
+}
+
+int CellList::cellCoord(double x, int d) const
+{
+    int c = (int)floor((x - lower[d]) / cell_size);
+    return std::min(std::max(c, 0), ncell[d] - 1);
+}
+
+void CellList::findCandidates(const std::array<double, NDIM> &x, double radius, std::vector<int> &candidates) const
+{
+    // collect all points inside the cells overlapped by the box [x - radius, x + radius]
+    // candidates are sorted so that they are visited in the same order as a plain loop over all points
+    candidates.clear();
+
+    std::array<int, NDIM> cmin, cmax;
+    for (int d = 0; d < NDIM; ++d)
+    {
+        cmin[d] = cellCoord(x[d] - radius, d);
+        cmax[d] = cellCoord(x[d] + radius, d);
+    }
+
+    for (int k = cmin[2]; k <= cmax[2]; ++k)
+    {
+        for (int j = cmin[1]; j <= cmax[1]; ++j)
+        {
+            for (int i = cmin[0]; i <= cmax[0]; ++i)
+            {
+                int c = (k * ncell[1] + j) * ncell[0] + i;
+                candidates.insert(candidates.end(), cell_items.begin() + cell_start[c], cell_items.begin() + cell_start[c + 1]);
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+}
+
+#endif
@@ -4,238 +4,227 @@
 
 /* note: the below code ignores some small perturbation terms (so some values may be different from finite difference) */
 
+// k * c_r * c_s, the larger index is multiplied first (or k * c_r^2 on the diagonal)
+inline double kcc(double k, const std::array<double, NDIM> &c, int r, int s)
+{
+    return r == s ? k * (c[r] * c[r]) : k * c[std::max(r, s)] * c[std::min(r, s)];
+}
+
 template <int nlayer>
-std::array<std::array<double, NDIM>, NDIM> fdu2dxyz(Particle<nlayer> *pi) /* The diagonal part */
+void fdu2dxyzRow(Particle<nlayer> *pi, const std::vector<int> &slot, std::vector<std::array<std::array<double, NDIM>, NDIM>> &K_row,
+                 std::vector<std::array<std::array<double, NDIM>, NDIM>> &K_work) /* The block row */
 {
-    std::array<std::array<double, NDIM>, NDIM> du2dxyz{0};
+    // K_ij of all conns j of pi (K_row is zero on entry and indexed by the position of j in pi's conns, slot maps a particle id
+    // to that position), every bond of pi and every chain of two bonds pi-pk-pj of the same layer is visited once
+    // each layer is summed separately before it is added, K_work holds the layers after the first one (it has to be zero
+    // and at least as long as the conn list, and is left zero)
+    BondStore<nlayer> &bs = *pi->bonds;
+
+    for (int i = 0; i < nlayer; i++)
+    {
+        std::vector<std::array<std::array<double, NDIM>, NDIM>> &K_layer = (i == 0) ? K_row : K_work;
+        for (int bd2 = pi->bond_ptr[i]; bd2 < pi->bond_ptr[i + 1]; ++bd2)
+        {
+            Particle<nlayer> *pk = bs.p2[bd2];
+            std::array<double, NDIM> c2{bs.csx[bd2], bs.csy[bd2], bs.csz[bd2]}, S_k{pk->cs_sumx[i], pk->cs_sumy[i], pk->cs_sumz[i]};
+            double w2 = 1 - bs.bdamage[bd2], Kn2 = bs.Kn[bd2], Tv2 = bs.Tv[bd2], wTv2 = w2 * Tv2;
+
+            // bond pi-pk
+            std::array<std::array<double, NDIM>, NDIM> &K_k = K_layer[slot[pk->id]];
+            for (int r = 0; r < NDIM; r++)
+                for (int s = 0; s < NDIM; s++)
+                    K_k[r][s] += w2 * ((-Kn2 * c2[s] + Tv2 * S_k[s]) * c2[r] - kcc(Kn2 + Tv2, c2, r, s));
+
+            // the other bonds pi-pj of the layer
+            for (int bd1 = pi->bond_ptr[i]; bd1 < pi->bond_ptr[i + 1]; ++bd1)
+            {
+                if (bs.p2[bd1]->id == pk->id)
+                    continue;
+                std::array<double, NDIM> c1{bs.csx[bd1], bs.csy[bd1], bs.csz[bd1]};
+                double T = 0.5 * ((1 - bs.bdamage[bd1]) * bs.Tv[bd1] + wTv2);
+                std::array<std::array<double, NDIM>, NDIM> &K_j = K_layer[slot[bs.p2[bd1]->id]];
+                for (int r = 0; r < NDIM; r++)
+                    for (int s = 0; s < NDIM; s++)
+                        K_j[r][s] -= T * c2[r] * c1[s];
+            }
+
+            // the bonds pk-pj of the layer
+            for (int bd3 = pk->bond_ptr[i]; bd3 < pk->bond_ptr[i + 1]; ++bd3)
+            {
+                if (bs.p2[bd3]->id == pi->id)
+                    continue;
+                std::array<double, NDIM> c3{bs.csx[bd3], bs.csy[bd3], bs.csz[bd3]};
+                double T = 0.5 * ((1 - bs.bdamage[bd3]) * bs.Tv[bd3] + wTv2);
+                std::array<std::array<double, NDIM>, NDIM> &K_j = K_layer[slot[bs.p2[bd3]->id]];
+                for (int r = 0; r < NDIM; r++)
+                    for (int s = 0; s < NDIM; s++)
+                        K_j[r][s] -= T * c2[r] * c3[s];
+            }
+        }
+
+        if (i == 0)
+            continue;
+        for (int k = 0; k < pi->nconn; k++)
+        {
+            for (int r = 0; r < NDIM; r++)
+                for (int s = 0; s < NDIM; s++)
+                    K_row[k][r][s] += K_layer[k][r][s];
+            K_layer[k] = std::array<std::array<double, NDIM>, NDIM>{0};
+        }
+    }
 
+    // diagonal block, all layers
+    std::array<std::array<double, NDIM>, NDIM> &K_i = K_row[slot[pi->id]];
+    K_i = std::array<std::array<double, NDIM>, NDIM>{0};
     for (int i = 0; i < nlayer; i++)
     {
-        for (Bond<nlayer> *bd : pi->bond_layers[i])
+        std::array<double, NDIM> S_i{pi->cs_sumx[i], pi->cs_sumy[i], pi->cs_sumz[i]};
+        for (int bd = pi->bond_ptr[i]; bd < pi->bond_ptr[i + 1]; ++bd)
         {
-            /*d2udxidxi, 1 1*/
-            du2dxyz[0][0] += (1 - bd->bdamage) * ((bd->Kn * bd->csx + bd->Tv * pi->cs_sumx[i]) * bd->csx +
-                                                  (bd->Kn + bd->Tv) * pow(bd->csx, 2));
-            /*d2udxidyi, 1 2*/
-            du2dxyz[0][1] += (1 - bd->bdamage) * ((bd->Kn * bd->csy + bd->Tv * pi->cs_sumy[i]) * bd->csx +
-                                                  (bd->Kn + bd->Tv) * bd->csy * bd->csx);
-            /*d2udxidzi, 1 3*/
-            du2dxyz[0][2] += (1 - bd->bdamage) * ((bd->Kn * bd->csz + bd->Tv * pi->cs_sumz[i]) * bd->csx +
-                                                  (bd->Kn + bd->Tv) * bd->csz * bd->csx);
-            /*d2udyidyi, 2 2*/
-            du2dxyz[1][1] += (1 - bd->bdamage) * ((bd->Kn * bd->csy + bd->Tv * pi->cs_sumy[i]) * bd->csy +
-                                                  (bd->Kn + bd->Tv) * pow(bd->csy, 2));
-            /*d2udyidzi, 2 3*/
-            du2dxyz[1][2] += (1 - bd->bdamage) * ((bd->Kn * bd->csz + bd->Tv * pi->cs_sumz[i]) * bd->csy +
-                                                  (bd->Kn + bd->Tv) * bd->csz * bd->csy);
-            /*d2udzidzi, 3 3*/
-            du2dxyz[2][2] += (1 - bd->bdamage) * ((bd->Kn * bd->csz + bd->Tv * pi->cs_sumz[i]) * bd->csz +
-                                                  (bd->Kn + bd->Tv) * pow(bd->csz, 2));
+            std::array<double, NDIM> c{bs.csx[bd], bs.csy[bd], bs.csz[bd]};
+            for (int r = 0; r < NDIM; r++)
+                for (int s = r; s < NDIM; s++)
+                    K_i[r][s] += (1 - bs.bdamage[bd]) * ((bs.Kn[bd] * c[s] + bs.Tv[bd] * S_i[s]) * c[r] + kcc(bs.Kn[bd] + bs.Tv[bd], c, r, s));
         }
     }
+    for (int r = 0; r < NDIM; r++)
+        for (int s = 0; s < r; s++)
+            K_i[r][s] = K_i[s][r];
+}
 
-    /*d2udyidxi, 2 1*/
-    du2dxyz[1][0] = du2dxyz[1][0];
-    /*d2udzidxi, 3 1*/
-    du2dxyz[2][0] = du2dxyz[0][2];
-    /*d2udzidyi, 3 2*/
-    du2dxyz[2][1] = du2dxyz[1][2];
+// Voigt components (11, 22, 33, 23, 13, 12) of c c^T, the order of the particle stress and plastic strain
+inline std::array<double, 2 * NDIM> voigtcc(double cx, double cy, double cz)
+{
+    return {cx * cx, cy * cy, cz * cz, cy * cz, cx * cz, cx * cy};
+}
 
-    return du2dxyz;
+// bond force before the last return mapping of the owner, whose layer sums the increments of the plastic stretch ddLp_sum
+template <int nlayer>
+double trialBondForce(BondStore<nlayer> &bs, int bd, double ddLp_sum)
+{
+    return bs.bforce[bd] + 2 * (bs.Kn[bd] * (bs.dLp[bd] - bs.dLp_last[bd]) + bs.Tv[bd] * ddLp_sum) * (1 - bs.bdamage[bd]);
 }
 
 template <int nlayer>
-std::array<std::array<double, NDIM>, NDIM> fdu2dxyz1(Particle<nlayer> *pi, Particle<nlayer> *pj) /* The off diagonal part */
+void dsigma2dxyz(Particle<nlayer> *p, const std::vector<int> &slot, std::vector<std::array<std::array<double, NDIM>, 2 * NDIM>> &S)
 {
-    std::array<std::array<double, NDIM>, NDIM> du2dxyz1{0};
+    // derivative of the trial stress (updateParticleStress before the return mapping) with respect to the coordinates of its
+    // conns, S[k] belongs to the k-th conn (slot maps a particle id to that position), the force of p's bond and of its opposite
+    // bond both vary, and so does the bond vector (the trial forces of a large plastic increment are not small)
+    BondStore<nlayer> &bs = *p->bonds;
+    S.assign(p->nconn, std::array<std::array<double, NDIM>, 2 * NDIM>{0});
+    double V_m = p->cell.particle_volume * p->nb / p->cell.nneighbors;
 
-    // find if pj is in pi's first neighbor list
-    for (Bond<nlayer> *bd1 : pi->bond_layers[0])
+    for (int i = 0; i < nlayer; i++)
     {
-        if (bd1->p2->id == pj->id)
+        std::array<double, NDIM> S_p{p->cs_sumx[i], p->cs_sumy[i], p->cs_sumz[i]};
+        std::array<double, 2 * NDIM> U{0}; // Tv part of the own bond forces, summed over the layer
+        double ddLp_p = 0;
+        for (int bd = p->bond_ptr[i]; bd < p->bond_ptr[i + 1]; ++bd)
+            ddLp_p += bs.dLp[bd] - bs.dLp_last[bd];
+
+        for (int bd = p->bond_ptr[i]; bd < p->bond_ptr[i + 1]; ++bd)
         {
-            for (Bond<nlayer> *bd2 : pi->bond_layers[0])
+            Particle<nlayer> *pk = bs.p2[bd];
+            int op = bs.op[bd];
+            double coef = 0.25 / V_m * bs.dis[bd];
+            double kn = coef * 2 * bs.Kn[bd] * (1 - bs.bdamage[bd]);
+            double kn_op = coef * 2 * bs.Kn[op] * (1 - bs.bdamage[op]), tv_op = coef * 2 * bs.Tv[op] * (1 - bs.bdamage[op]);
+            std::array<double, 2 * NDIM> A = voigtcc(bs.csx[bd], bs.csy[bd], bs.csz[bd]);
+            std::array<double, NDIM> c{bs.csx[bd], bs.csy[bd], bs.csz[bd]}, c_op{bs.csx[op], bs.csy[op], bs.csz[op]}, S_k{pk->cs_sumx[i], pk->cs_sumy[i], pk->cs_sumz[i]};
+
+            // the bond vector turns and stretches under the average force, d(dis c_r c_s) = du_r c_s + c_r du_s - c_r c_s (c . du)
+            const int vr[2 * NDIM]{0, 1, 2, 1, 0, 0}, vs[2 * NDIM]{0, 1, 2, 2, 2, 1};
+            double ddLp_k = 0;
+            for (int bd2 = pk->bond_ptr[i]; bd2 < pk->bond_ptr[i + 1]; ++bd2)
+                ddLp_k += bs.dLp[bd2] - bs.dLp_last[bd2];
+            double f = 0.25 / V_m * (trialBondForce(bs, bd, ddLp_p) + trialBondForce(bs, op, ddLp_k));
+            for (int q = 0; q < 2 * NDIM; q++)
             {
-                if (bd1->p2->id == bd2->p2->id)
+                U[q] += coef * 2 * bs.Tv[bd] * (1 - bs.bdamage[bd]) * A[q];
+                for (int r = 0; r < NDIM; r++)
                 {
-                    /*d2udxidxj, 1 1*/
-                    du2dxyz1[0][0] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csx + bd2->Tv * bd2->p2->cs_sumx[0]) * bd2->csx -
-                                                            (bd2->Kn + bd2->Tv) * pow(bd2->csx, 2));
-                    /*d2udxidyj, 1 2*/
-                    du2dxyz1[0][1] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csy + bd2->Tv * bd2->p2->cs_sumy[0]) * bd2->csx -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csy * bd2->csx);
-                    /*d2udxidzj, 1 3*/
-                    du2dxyz1[0][2] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csz + bd2->Tv * bd2->p2->cs_sumz[0]) * bd2->csx -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csx);
-                    /*d2udyidxj, 2 1*/
-                    du2dxyz1[1][0] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csx + bd2->Tv * bd2->p2->cs_sumx[0]) * bd2->csy -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csy * bd2->csx);
-                    /*d2udyidyj, 2 2*/
-                    du2dxyz1[1][1] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csy + bd2->Tv * bd2->p2->cs_sumy[0]) * bd2->csy -
-                                                            (bd2->Kn + bd2->Tv) * pow(bd2->csy, 2));
-                    /*d2udyidzj, 2 3*/
-                    du2dxyz1[1][2] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csz + bd2->Tv * bd2->p2->cs_sumz[0]) * bd2->csy -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csy);
-                    /*d2udzidxj, 3 1*/
-                    du2dxyz1[2][0] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csx + bd2->Tv * bd2->p2->cs_sumx[0]) * bd2->csz -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csx);
-                    /*d2udzidyj, 3 2*/
-                    du2dxyz1[2][1] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csy + bd2->Tv * bd2->p2->cs_sumy[0]) * bd2->csz -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csy);
-                    /*d2udzidzj, 3 3*/
-                    du2dxyz1[2][2] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csz + bd2->Tv * bd2->p2->cs_sumz[0]) * bd2->csz -
-                                                            (bd2->Kn + bd2->Tv) * pow(bd2->csz, 2));
-                }
-                else
-                {
-                    du2dxyz1[0][0] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd1->csx; /*d2udxidxj, 1 1*/
-                    du2dxyz1[0][1] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd1->csy; /*d2udxidyj, 1 2*/
-                    du2dxyz1[0][2] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd1->csz; /*d2udxidzj, 1 3*/
-                    du2dxyz1[1][0] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd1->csx; /*d2udyidxj, 2 1*/
-                    du2dxyz1[1][1] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd1->csy; /*d2udyidyj, 2 2*/
-                    du2dxyz1[1][2] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd1->csz; /*d2udyidzj, 2 3*/
-                    du2dxyz1[2][0] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd1->csx; /*d2udzidxj, 3 1*/
-                    du2dxyz1[2][1] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd1->csy; /*d2udzidyj, 3 2*/
-                    du2dxyz1[2][2] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd1->csz; /*d2udzidzj, 3 3*/
-
-                    for (Bond<nlayer> *bd3 : bd2->p2->bond_layers[0])
-                    {
-                        if (bd3->p2->id == pj->id)
-                        {
-                            du2dxyz1[0][0] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd3->csx; /*d2udxidxj, 1 1*/
-                            du2dxyz1[0][1] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd3->csy; /*d2udxidyj, 1 2*/
-                            du2dxyz1[0][2] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd3->csz; /*d2udxidzj, 1 3*/
-                            du2dxyz1[1][0] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd3->csx; /*d2udyidxj, 2 1*/
-                            du2dxyz1[1][1] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd3->csy; /*d2udyidyj, 2 2*/
-                            du2dxyz1[1][2] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd3->csz; /*d2udyidzj, 2 3*/
-                            du2dxyz1[2][0] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd3->csx; /*d2udzidxj, 3 1*/
-                            du2dxyz1[2][1] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd3->csy; /*d2udzidyj, 3 2*/
-                            du2dxyz1[2][2] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd3->csz; /*d2udzidzj, 3 3*/
-                        }
-                    }
+                    double G = f * ((r == vr[q]) * c[vs[q]] + (r == vs[q]) * c[vr[q]] - A[q] * c[r]);
+                    S[slot[p->id]][q][r] += A[q] * (kn * c[r] - kn_op * c_op[r]) + G;
+                    S[slot[pk->id]][q][r] += A[q] * (-kn * c[r] + kn_op * c_op[r] + tv_op * S_k[r]) - G;
                 }
             }
-            return du2dxyz1;
-        }
-    }
 
-    for (Bond<nlayer> *bd1 : pi->bond_layers[0])
-    {
-        for (Bond<nlayer> *bd2 : bd1->p2->bond_layers[0])
-        {
-            if (bd2->p2->id == pj->id)
+            // Tv part of the opposite bond force, through the bonds pk-pm of the layer
+            for (int bd2 = pk->bond_ptr[i]; bd2 < pk->bond_ptr[i + 1]; ++bd2)
             {
-                du2dxyz1[0][0] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csx * bd2->csx; /*d2udxidxj, 1 1*/
-                du2dxyz1[0][1] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csx * bd2->csy; /*d2udxidyj, 1 2*/
-                du2dxyz1[0][2] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csx * bd2->csz; /*d2udxidzj, 1 3*/
-                du2dxyz1[1][0] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csy * bd2->csx; /*d2udyidxj, 2 1*/
-                du2dxyz1[1][1] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csy * bd2->csy; /*d2udyidyj, 2 2*/
-                du2dxyz1[1][2] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csy * bd2->csz; /*d2udyidzj, 2 3*/
-                du2dxyz1[2][0] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csz * bd2->csx; /*d2udzidxj, 3 1*/
-                du2dxyz1[2][1] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csz * bd2->csy; /*d2udzidyj, 3 2*/
-                du2dxyz1[2][2] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csz * bd2->csz; /*d2udzidzj, 3 3*/
+                std::array<std::array<double, NDIM>, 2 * NDIM> &S_m = S[slot[bs.p2[bd2]->id]];
+                std::array<double, NDIM> c2{bs.csx[bd2], bs.csy[bd2], bs.csz[bd2]};
+                for (int q = 0; q < 2 * NDIM; q++)
+                    for (int r = 0; r < NDIM; r++)
+                        S_m[q][r] -= tv_op * A[q] * c2[r];
             }
         }
-    }
 
-    return du2dxyz1;
+        for (int bd = p->bond_ptr[i]; bd < p->bond_ptr[i + 1]; ++bd)
+        {
+            std::array<std::array<double, NDIM>, 2 * NDIM> &S_j = S[slot[bs.p2[bd]->id]];
+            std::array<double, NDIM> c{bs.csx[bd], bs.csy[bd], bs.csz[bd]};
+            for (int q = 0; q < 2 * NDIM; q++)
+                for (int r = 0; r < NDIM; r++)
+                    S_j[q][r] -= U[q] * c[r];
+        }
+        for (int q = 0; q < 2 * NDIM; q++)
+            for (int r = 0; r < NDIM; r++)
+                S[slot[p->id]][q][r] += U[q] * S_p[r];
+    }
 }
 
 template <int nlayer>
-std::array<std::array<double, NDIM>, NDIM> fdu2dxyz2(Particle<nlayer> *pi, Particle<nlayer> *pj) /* The off diagonal part */
+void dFpl2dsigma(Particle<nlayer> *p, const std::array<std::array<double, 2 * NDIM>, 2 * NDIM> &dep_dsigma, std::vector<std::array<double, 2 * NDIM>> &g)
 {
-    std::array<std::array<double, NDIM>, NDIM> du2dxyz2{0};
+    // derivative of the bond forces of p with respect to its trial stress through the return mapping, the plastic stretch
+    // dLp_b grows by dis_b * (dplstrain : c_b c_b) with d(dplstrain) = dep_dsigma d(stress), so dF_b = g_b . d(stress)
+    BondStore<nlayer> &bs = *p->bonds;
+    const double w[2 * NDIM]{1, 1, 1, 2, 2, 2};
 
-    // find if pj is in pi's first neighbor list
-    for (Bond<nlayer> *bd1 : pi->bond_layers[1])
+    for (int i = 0; i < nlayer; i++)
     {
-        if (bd1->p2->id == pj->id)
+        std::array<double, 2 * NDIM> a_sum{0};
+        for (int bd = p->bond_ptr[i]; bd < p->bond_ptr[i + 1]; ++bd)
         {
-            for (Bond<nlayer> *bd2 : pi->bond_layers[1])
-            {
-                if (bd1->p2->id == bd2->p2->id)
-                {
-                    /*d2udxidxj, 1 1*/
-                    du2dxyz2[0][0] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csx + bd2->Tv * bd2->p2->cs_sumx[1]) * bd2->csx -
-                                                            (bd2->Kn + bd2->Tv) * pow(bd2->csx, 2));
-                    /*d2udxidyj, 1 2*/
-                    du2dxyz2[0][1] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csy + bd2->Tv * bd2->p2->cs_sumy[1]) * bd2->csx -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csy * bd2->csx);
-                    /*d2udxidzj, 1 3*/
-                    du2dxyz2[0][2] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csz + bd2->Tv * bd2->p2->cs_sumz[1]) * bd2->csx -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csx);
-                    /*d2udyidxj, 2 1*/
-                    du2dxyz2[1][0] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csx + bd2->Tv * bd2->p2->cs_sumx[1]) * bd2->csy -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csy * bd2->csx);
-                    /*d2udyidyj, 2 2*/
-                    du2dxyz2[1][1] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csy + bd2->Tv * bd2->p2->cs_sumy[1]) * bd2->csy -
-                                                            (bd2->Kn + bd2->Tv) * pow(bd2->csy, 2));
-                    /*d2udyidzj, 2 3*/
-                    du2dxyz2[1][2] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csz + bd2->Tv * bd2->p2->cs_sumz[1]) * bd2->csy -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csy);
-                    /*d2udzidxj, 3 1*/
-                    du2dxyz2[2][0] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csx + bd2->Tv * bd2->p2->cs_sumx[1]) * bd2->csz -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csx);
-                    /*d2udzidyj, 3 2*/
-                    du2dxyz2[2][1] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csy + bd2->Tv * bd2->p2->cs_sumy[1]) * bd2->csz -
-                                                            (bd2->Kn + bd2->Tv) * bd2->csz * bd2->csy);
-                    /*d2udzidzj, 3 3*/
-                    du2dxyz2[2][2] += (1 - bd2->bdamage) * ((-bd2->Kn * bd2->csz + bd2->Tv * bd2->p2->cs_sumz[1]) * bd2->csz -
-                                                            (bd2->Kn + bd2->Tv) * pow(bd2->csz, 2));
-                }
-                else
-                {
-                    du2dxyz2[0][0] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd1->csx; /*d2udxidxj, 1 1*/
-                    du2dxyz2[0][1] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd1->csy; /*d2udxidyj, 1 2*/
-                    du2dxyz2[0][2] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd1->csz; /*d2udxidzj, 1 3*/
-                    du2dxyz2[1][0] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd1->csx; /*d2udyidxj, 2 1*/
-                    du2dxyz2[1][1] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd1->csy; /*d2udyidyj, 2 2*/
-                    du2dxyz2[1][2] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd1->csz; /*d2udyidzj, 2 3*/
-                    du2dxyz2[2][0] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd1->csx; /*d2udzidxj, 3 1*/
-                    du2dxyz2[2][1] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd1->csy; /*d2udzidyj, 3 2*/
-                    du2dxyz2[2][2] -= 0.5 * ((1 - bd1->bdamage) * bd1->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd1->csz; /*d2udzidzj, 3 3*/
-
-                    for (Bond<nlayer> *bd3 : bd2->p2->bond_layers[1])
-                    {
-                        if (bd3->p2->id == pj->id)
-                        {
-                            du2dxyz2[0][0] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd3->csx; /*d2udxidxj, 1 1*/
-                            du2dxyz2[0][1] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd3->csy; /*d2udxidyj, 1 2*/
-                            du2dxyz2[0][2] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csx * bd3->csz; /*d2udxidzj, 1 3*/
-                            du2dxyz2[1][0] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd3->csx; /*d2udyidxj, 2 1*/
-                            du2dxyz2[1][1] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd3->csy; /*d2udyidyj, 2 2*/
-                            du2dxyz2[1][2] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csy * bd3->csz; /*d2udyidzj, 2 3*/
-                            du2dxyz2[2][0] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd3->csx; /*d2udzidxj, 3 1*/
-                            du2dxyz2[2][1] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd3->csy; /*d2udzidyj, 3 2*/
-                            du2dxyz2[2][2] -= 0.5 * ((1 - bd3->bdamage) * bd3->Tv + (1 - bd2->bdamage) * bd2->Tv) * bd2->csz * bd3->csz; /*d2udzidzj, 3 3*/
-                        }
-                    }
-                }
-            }
-            return du2dxyz2;
+            std::array<double, 2 * NDIM> A = voigtcc(bs.csx[bd], bs.csy[bd], bs.csz[bd]);
+            for (int q = 0; q < 2 * NDIM; q++)
+                a_sum[q] += bs.dis[bd] * w[q] * A[q];
         }
-    }
 
-    for (Bond<nlayer> *bd1 : pi->bond_layers[1])
-    {
-        for (Bond<nlayer> *bd2 : bd1->p2->bond_layers[1])
+        for (int bd = p->bond_ptr[i]; bd < p->bond_ptr[i + 1]; ++bd)
         {
-            if (bd2->p2->id == pj->id)
+            std::array<double, 2 * NDIM> A = voigtcc(bs.csx[bd], bs.csy[bd], bs.csz[bd]), v;
+            for (int q = 0; q < 2 * NDIM; q++)
+                v[q] = 2 * bs.Kn[bd] * bs.dis[bd] * w[q] * A[q] + 2 * bs.Tv[bd] * a_sum[q];
+            for (int q = 0; q < 2 * NDIM; q++)
             {
-                du2dxyz2[0][0] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csx * bd2->csx; /*d2udxidxj, 1 1*/
-                du2dxyz2[0][1] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csx * bd2->csy; /*d2udxidyj, 1 2*/
-                du2dxyz2[0][2] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csx * bd2->csz; /*d2udxidzj, 1 3*/
-                du2dxyz2[1][0] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csy * bd2->csx; /*d2udyidxj, 2 1*/
-                du2dxyz2[1][1] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csy * bd2->csy; /*d2udyidyj, 2 2*/
-                du2dxyz2[1][2] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csy * bd2->csz; /*d2udyidzj, 2 3*/
-                du2dxyz2[2][0] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csz * bd2->csx; /*d2udzidxj, 3 1*/
-                du2dxyz2[2][1] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csz * bd2->csy; /*d2udzidyj, 3 2*/
-                du2dxyz2[2][2] -= 0.5 * ((1 - bd2->bdamage) * bd2->Tv + (1 - bd1->bdamage) * bd1->Tv) * bd1->csz * bd2->csz; /*d2udzidzj, 3 3*/
+                g[bd][q] = 0;
+                for (int j = 0; j < 2 * NDIM; j++)
+                    g[bd][q] -= (1 - bs.bdamage[bd]) * v[j] * dep_dsigma[j][q];
             }
         }
     }
+}
 
-    return du2dxyz2;
+template <int nlayer>
+void dLp2dxyz(Particle<nlayer> *p, const std::array<double, 2 * NDIM> &dplstrain, std::vector<std::array<double, NDIM>> &h)
+{
+    // derivative of the plastic stretch increment of p's bonds, dis_b * (dplstrain : c_b c_b), with respect to the bond vector
+    // x_p - x_k at a fixed plastic strain increment E: h_b = 2 E c_b - (c_b . E c_b) c_b
+    BondStore<nlayer> &bs = *p->bonds;
+    const std::array<double, 2 * NDIM> &E = dplstrain;
+    for (int bd = p->bond_ptr[0]; bd < p->bond_ptr[nlayer]; ++bd)
+    {
+        std::array<double, NDIM> c{bs.csx[bd], bs.csy[bd], bs.csz[bd]};
+        std::array<double, NDIM> Ec{E[0] * c[0] + E[5] * c[1] + E[4] * c[2],
+                                    E[5] * c[0] + E[1] * c[1] + E[3] * c[2],
+                                    E[4] * c[0] + E[3] * c[1] + E[2] * c[2]};
+        double e = c[0] * Ec[0] + c[1] * Ec[1] + c[2] * Ec[2];
+        for (int r = 0; r < NDIM; r++)
+            h[bd][r] = 2 * Ec[r] - e * c[r];
+    }
 }
 
 #endif
\ No newline at end of file
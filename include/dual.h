@@ -0,0 +1,40 @@
+#pragma once
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <cmath>
+
+// Forward-mode dual number v + d * e with e^2 = 0, d carries the derivative with respect to one seeded variable
+// Comparisons only look at the value, so branches (e.g., broken bonds) follow the undifferentiated code
+
+struct Dual
+{
+    double v{0}, d{0};
+
+    Dual() = default;
+    Dual(double p_v, double p_d = 0) : v{p_v}, d{p_d} {}
+
+    Dual &operator+=(const Dual &b)
+    {
+        v += b.v, d += b.d;
+        return *this;
+    }
+};
+
+inline Dual operator+(const Dual &a, const Dual &b) { return {a.v + b.v, a.d + b.d}; }
+inline Dual operator-(const Dual &a, const Dual &b) { return {a.v - b.v, a.d - b.d}; }
+inline Dual operator-(const Dual &a) { return {-a.v, -a.d}; }
+inline Dual operator*(const Dual &a, const Dual &b) { return {a.v * b.v, a.d * b.v + a.v * b.d}; }
+inline Dual operator/(const Dual &a, const Dual &b) { return {a.v / b.v, (a.d * b.v - a.v * b.d) / (b.v * b.v)}; }
+inline bool operator<(const Dual &a, const Dual &b) { return a.v < b.v; }
+inline bool operator>(const Dual &a, const Dual &b) { return a.v > b.v; }
+
+inline Dual sqrt(const Dual &a)
+{
+    double s = std::sqrt(a.v);
+    return {s, 0.5 * a.d / s};
+}
+
+inline Dual fabs(const Dual &a) { return a.v < 0 ? -a : a; }
+
+#endif
@@ -0,0 +1,317 @@
+#pragma once
+#ifndef GMG_H
+#define GMG_H
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+#include "lpm.h"
+#include "amg.h"
+#include "cell_list.h"
+
+// Geometric multigrid on a hierarchy of lattices of the specimen (the particle radius doubled at each level), applied
+// as one symmetric V-cycle per CG iteration. The transfer between two lattices interpolates from the particle
+// positions, the coarse operators are Galerkin products and all levels are smoothed by Gauss-Seidel over the colors
+// of the particle blocks
+
+class GMG
+{
+    struct Level
+    {
+        CSRMatrix A, P, R;                      // operator, prolongator from the next level and restriction (P^T)
+        std::vector<MKL_INT> node_ptr;          // first row of each particle block and the size at the end
+        std::vector<int> color_ptr, color_node; // blocks grouped by color, the blocks of a color are not coupled
+        std::vector<double> dinv;               // inverse diagonal of A, 0 for an empty row
+        std::vector<double> x, b, r;            // work vectors of the cycle
+    };
+
+    std::vector<Level> levels;
+    std::vector<MKL_INT> fine_src; // entry of the upper triangle system of each entry of the first level operator
+    DenseCholesky coarse;          // factor of the coarsest operator, empty if it is smoothed instead
+
+    void transfer(const std::vector<std::array<double, NDIM>> &xyz_f, const std::vector<std::array<double, NDIM>> &xyz_c,
+                  double h, int dim, const std::array<double, NDIM * NDIM> &R, std::vector<MKL_INT> &dofs, Level &L, std::vector<MKL_INT> &node_ptr_c);
+    void colorBlocks(Level &L);
+    void coarsen(); // Galerkin operators and diagonals of the coarse levels, and the coarsest factor
+    void sweep(Level &L, bool forward);
+    void cycle(size_t l);
+
+public:
+    int max_levels{10}, coarse_size{500}, n_smooth{1};
+
+    // blocks: first DOF of each particle and n at the end; xyz: particle positions of each level, the particles of the
+    // system first; radius: particle radius of each coarse level (xyz[l + 1]); dofs: system DOF of each coordinate of the
+    // particles of the system, -1 if it is not solved for; R: rotation of the lattices (row-major)
+    void setup(MKL_INT n, const MKL_INT *IK, const MKL_INT *JK, const double *K, const std::vector<MKL_INT> &blocks,
+               const std::vector<std::vector<std::array<double, NDIM>>> &xyz, const std::vector<double> &radius,
+               const std::vector<MKL_INT> &dofs, int dim, const std::array<double, NDIM * NDIM> &R);
+    void updateFine(const double *K); // new values of the first level, same pattern, the coarse operators follow
+    void apply(const double *r, double *z);
+};
+
+void GMG::setup(MKL_INT n, const MKL_INT *IK, const MKL_INT *JK, const double *K, const std::vector<MKL_INT> &blocks,
+                const std::vector<std::vector<std::array<double, NDIM>>> &xyz, const std::vector<double> &radius,
+                const std::vector<MKL_INT> &dofs, int dim, const std::array<double, NDIM * NDIM> &R)
+{
+    levels.clear();
+    levels.emplace_back();
+    levels[0].A = symmetricCSR(n, IK, JK, fine_src);
+    levels[0].node_ptr = blocks;
+
+    std::vector<MKL_INT> dofs_l(dofs);
+    for (size_t l = 0; l + 1 < xyz.size() && (int)levels.size() < max_levels && levels[l].A.nrow > coarse_size; ++l)
+    {
+        std::vector<MKL_INT> node_ptr_c;
+        transfer(xyz[l], xyz[l + 1], 2 * radius[l], dim, R, dofs_l, levels[l], node_ptr_c);
+        MKL_INT nc = node_ptr_c.back();
+        if (nc == 0 || nc > 0.8 * levels[l].A.nrow)
+            break; // the lattice is not coarser for this system
+
+        levels.emplace_back();
+        levels.back().node_ptr.swap(node_ptr_c);
+        levels.back().A.nrow = nc;
+    }
+    levels.back().P = CSRMatrix{}, levels.back().R = CSRMatrix{};
+
+    // the patterns of the coarse operators do not depend on the values, the colors are kept until the next setup
+    updateFine(K);
+    for (Level &L : levels)
+    {
+        colorBlocks(L);
+        L.x.assign(L.A.nrow, 0.0);
+        L.b.assign(L.A.nrow, 0.0);
+        L.r.assign(L.A.nrow, 0.0);
+    }
+
+    double nnz{0};
+    for (Level &L : levels)
+        nnz += L.A.ia[L.A.nrow];
+    printf("    GMG: %zu levels, coarsest %lld DOFs, operator complexity %.2f\n", levels.size(), (long long)levels.back().A.nrow, nnz / levels[0].A.ia[n]);
+}
+
+void GMG::transfer(const std::vector<std::array<double, NDIM>> &xyz_f, const std::vector<std::array<double, NDIM>> &xyz_c,
+                   double h, int dim, const std::array<double, NDIM * NDIM> &R, std::vector<MKL_INT> &dofs, Level &L, std::vector<MKL_INT> &node_ptr_c)
+{
+    // tensor product hat functions of width h in the lattice frame, normalized to a partition of unity (exact for the
+    // translations, and for the linear fields on square and cubic lattices); a particle out of reach of all of them
+    // takes the nearest coarse particle. dofs is replaced by the DOFs of the coarse particles
+    CellList cells(xyz_c, h);
+    int nf = (int)xyz_f.size(), nc = (int)xyz_c.size();
+    std::vector<std::vector<std::pair<int, double>>> weights(nf);
+#pragma omp parallel
+    {
+        std::vector<int> candidates;
+#pragma omp for
+        for (int i = 0; i < nf; ++i)
+        {
+            bool solved{false};
+            for (int k = 0; k < dim; ++k)
+                solved = solved || dofs[dim * i + k] >= 0;
+            if (!solved)
+                continue;
+
+            double sum{0}, nearest{1e300};
+            int inearest{-1};
+            cells.findCandidates(xyz_f[i], 2 * h, candidates);
+            for (int J : candidates)
+            {
+                std::array<double, NDIM> dx, u{0, 0, 0};
+                for (int a = 0; a < NDIM; ++a)
+                    dx[a] = xyz_f[i][a] - xyz_c[J][a];
+                for (int a = 0; a < NDIM; ++a)
+                    for (int b = 0; b < NDIM; ++b)
+                        u[a] += R[b * NDIM + a] * dx[b];
+
+                double w{1}, d2{0};
+                for (int a = 0; a < dim; ++a)
+                    w *= std::max(0.0, 1.0 - std::abs(u[a]) / h), d2 += dx[a] * dx[a];
+                if (w > 1e-12)
+                    weights[i].push_back({J, w}), sum += w;
+                if (d2 < nearest)
+                    nearest = d2, inearest = J;
+            }
+            if (weights[i].empty() && inearest >= 0)
+                weights[i].push_back({inearest, 1.0}), sum = 1.0;
+            for (std::pair<int, double> &jw : weights[i])
+                jw.second /= sum;
+        }
+    }
+
+    // a coordinate of a coarse particle is solved for if a DOF of the same coordinate interpolates from it
+    std::vector<MKL_INT> dofs_c(dim * nc, -1);
+    for (int i = 0; i < nf; ++i)
+        for (const std::pair<int, double> &jw : weights[i])
+            for (int k = 0; k < dim; ++k)
+                if (dofs[dim * i + k] >= 0)
+                    dofs_c[dim * jw.first + k] = 0;
+    node_ptr_c.assign(1, 0);
+    MKL_INT count{0};
+    for (int J = 0; J < nc; ++J)
+    {
+        for (int k = 0; k < dim; ++k)
+            if (dofs_c[dim * J + k] >= 0)
+                dofs_c[dim * J + k] = count++;
+        if (count > node_ptr_c.back())
+            node_ptr_c.push_back(count);
+    }
+
+    CSRMatrix &P = L.P;
+    P.nrow = L.A.nrow, P.ncol = count;
+    P.ia.assign(P.nrow + 1, 0);
+    for (int i = 0; i < nf; ++i)
+        for (int k = 0; k < dim; ++k)
+            if (dofs[dim * i + k] >= 0)
+                P.ia[dofs[dim * i + k] + 1] = weights[i].size();
+    for (MKL_INT r = 0; r < P.nrow; ++r)
+        P.ia[r + 1] += P.ia[r];
+    P.ja.resize(P.ia[P.nrow]);
+    P.a.resize(P.ia[P.nrow]);
+    for (int i = 0; i < nf; ++i)
+    {
+        for (int k = 0; k < dim; ++k)
+        {
+            MKL_INT r = dofs[dim * i + k];
+            if (r < 0)
+                continue;
+            MKL_INT e = P.ia[r];
+            for (const std::pair<int, double> &jw : weights[i])
+                P.ja[e] = dofs_c[dim * jw.first + k], P.a[e++] = jw.second;
+        }
+    }
+    L.R = transposeCSR(P);
+    dofs.swap(dofs_c);
+}
+
+void GMG::colorBlocks(Level &L)
+{
+    // greedy coloring of the block graph of the operator
+    std::vector<MKL_INT> g_ptr, g_adj;
+    blockGraph(L.A, L.node_ptr, g_ptr, g_adj);
+    int nnode = (int)L.node_ptr.size() - 1, ncolor{0};
+    std::vector<int> color(nnode, -1), mark;
+    for (int I = 0; I < nnode; ++I)
+    {
+        mark.assign(ncolor + 1, -1);
+        for (MKL_INT e = g_ptr[I]; e < g_ptr[I + 1]; ++e)
+            if (color[g_adj[e]] >= 0)
+                mark[color[g_adj[e]]] = I;
+        int c{0};
+        while (mark[c] == I)
+            ++c;
+        color[I] = c;
+        ncolor = std::max(ncolor, c + 1);
+    }
+
+    L.color_ptr.assign(ncolor + 1, 0);
+    for (int I = 0; I < nnode; ++I)
+        ++L.color_ptr[color[I] + 1];
+    for (int c = 0; c < ncolor; ++c)
+        L.color_ptr[c + 1] += L.color_ptr[c];
+    L.color_node.resize(nnode);
+    std::vector<int> next(L.color_ptr.begin(), L.color_ptr.end() - 1);
+    for (int I = 0; I < nnode; ++I)
+        L.color_node[next[color[I]]++] = I;
+}
+
+void GMG::updateFine(const double *K)
+{
+    Level &L = levels[0];
+#pragma omp parallel for
+    for (MKL_INT e = 0; e < (MKL_INT)fine_src.size(); ++e)
+        L.A.a[e] = K[fine_src[e]];
+    coarsen();
+}
+
+void GMG::coarsen()
+{
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        Level &L = levels[l];
+        if (l > 0)
+            L.A = multiplyCSR(levels[l - 1].R, multiplyCSR(levels[l - 1].A, levels[l - 1].P));
+        L.dinv.assign(L.A.nrow, 0.0);
+#pragma omp parallel for
+        for (MKL_INT i = 0; i < L.A.nrow; ++i)
+        {
+            for (MKL_INT e = L.A.ia[i]; e < L.A.ia[i + 1]; ++e)
+            {
+                if (L.A.ja[e] == i && L.A.a[e] > 0)
+                    L.dinv[i] = 1.0 / L.A.a[e];
+            }
+        }
+    }
+    coarse.factor(levels.back().A, levels.back().dinv, 3 * coarse_size);
+}
+
+void GMG::sweep(Level &L, bool forward)
+{
+    // Gauss-Seidel, color by color and the rows of a block in order; the backward sweep visits the rows in the
+    // reverse order, so that a forward and a backward sweep make a symmetric smoother
+    int ncolor = (int)L.color_ptr.size() - 1;
+    for (int ic = 0; ic < ncolor; ++ic)
+    {
+        int c = forward ? ic : ncolor - 1 - ic;
+#pragma omp parallel for
+        for (int q = L.color_ptr[c]; q < L.color_ptr[c + 1]; ++q)
+        {
+            int I = L.color_node[q];
+            MKL_INT d0 = L.node_ptr[I], m = L.node_ptr[I + 1] - d0;
+            for (MKL_INT t = 0; t < m; ++t)
+            {
+                MKL_INT i = forward ? d0 + t : d0 + m - 1 - t;
+                double s = L.b[i];
+                for (MKL_INT e = L.A.ia[i]; e < L.A.ia[i + 1]; ++e)
+                    s -= L.A.a[e] * L.x[L.A.ja[e]];
+                L.x[i] += L.dinv[i] * s;
+            }
+        }
+    }
+}
+
+void GMG::cycle(size_t l)
+{
+    Level &L = levels[l];
+    std::fill(L.x.begin(), L.x.end(), 0.0);
+    if (l + 1 == levels.size())
+    {
+        if (!coarse.empty())
+            coarse.solve(L.b.data(), L.x.data());
+        else
+        {
+            // too large for a dense factorization, smoothed only
+            for (int s = 0; s < 5 * n_smooth; ++s)
+                sweep(L, true), sweep(L, false);
+        }
+        return;
+    }
+
+    // forward sweeps from zero, residual to the next level, correction, and backward sweeps (symmetric)
+    MKL_INT n = L.A.nrow;
+    for (int s = 0; s < n_smooth; ++s)
+        sweep(L, true);
+
+    L.A.multiply(L.x.data(), L.r.data());
+#pragma omp parallel for
+    for (MKL_INT i = 0; i < n; ++i)
+        L.r[i] = L.b[i] - L.r[i];
+    L.R.multiply(L.r.data(), levels[l + 1].b.data());
+    cycle(l + 1);
+    L.P.multiply(levels[l + 1].x.data(), L.r.data());
+#pragma omp parallel for
+    for (MKL_INT i = 0; i < n; ++i)
+        L.x[i] += L.r[i];
+
+    for (int s = 0; s < n_smooth; ++s)
+        sweep(L, false);
+}
+
+void GMG::apply(const double *r, double *z)
+{
+    std::copy(r, r + levels[0].A.nrow, levels[0].b.begin());
+    cycle(0);
+    std::copy(levels[0].x.begin(), levels[0].x.end(), z);
+}
+
+#endif
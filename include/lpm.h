@@ -76,10 +76,27 @@ enum class SolverMode : char
     PARDISO
 };
 
+enum class NewtonMode : char
+{
+    Full,    // the linear solver follows every new stiffness matrix
+    Modified // the last factorization is kept until the convergence stalls or the damage changes (PARDISO)
+};
+
+enum class PreconditionerMode : char
+{
+    None,
+    Jacobi,      // inverse diagonal
+    BlockJacobi, // inverse of the diagonal block of each particle
+    IC0,         // incomplete Cholesky without fill-in
+    AMG,         // smoothed aggregation multigrid V-cycle, the hierarchy is kept until the topology changes
+    GMG          // geometric multigrid V-cycle on coarser lattices of the specimen, colored Gauss-Seidel smoothing
+};
+
 enum class StiffnessMode : char
 {
     Analytical,
-    FiniteDifference
+    FiniteDifference,
+    AutomaticDifferentiation // forward mode, dual numbers through the bond geometry and force
 };
 
 enum class TimeMapMode : char
@@ -96,6 +113,27 @@ enum class ParticleType : char
     FatigueHCF
 };
 
+enum class ReorderMode : char
+{
+    None,   // particles are numbered in the input order
+    Morton, // space-filling (Z-order) curve of the coordinates
+    RCM     // reverse Cuthill-McKee of the bond graph
+};
+
+enum class SimdMode : char
+{
+    Auto,   // best instruction set supported by the cpu
+    Scalar, // baseline scalar loops
+    Verify  // best instruction set, checked bitwise against the scalar loops
+};
+
+enum class SimdISA : char
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
 enum class LatticeType : char
 {
     Square2D,
@@ -8,8 +8,15 @@
 
 #include "lpm.h"
 #include "unit_cell.h"
+#include "dual.h"
 #include "bond.h"
 
+template <int nlayer>
+class BondStore;
+
+template <int nlayer>
+class BondTangent;
+
 template <int nlayer>
 class Particle
 {
@@ -18,6 +25,7 @@ protected:
 
 public:
     int id{0};                                                                   // identifier of the particle, id starts from 0
+    int id_initial{0};                                                           // identifier in the input order (before reordering), used in output files
     int type{0};                                                                 // particle type which is needed to identify phases
     int nconn_largeq{0};                                                         // matrix pointer, number of conn larger than (or equal to) its own index
     int nb{0}, nconn{0};                                                         // number of bonds and connections
@@ -30,13 +38,14 @@ public:
     std::array<double, nlayer> TdLe_total, dLe_total, cs_sumx, cs_sumy, cs_sumz; // volumetric bond measure
     std::array<double, NDIM> xyz, xyz_initial, xyz_last;                         // particle coordinates
     std::array<double, NDIM> Pin{0}, Pex{0};                                     // internal and external particle force
-    std::array<std::vector<Bond<nlayer> *>, nlayer> bond_layers;                 // an array that store n layers of bonds
+    std::array<int, nlayer + 1> bond_ptr{0};                                     // bonds of layer i are [bond_ptr[i], bond_ptr[i + 1]) in the bond store
+    BondStore<nlayer> *bonds{nullptr};                                           // bond store of the particle system (not owned by the particle)
     std::vector<Particle<nlayer> *> neighbors;                                   // vector that stores all particles that form bonds
     std::vector<Particle<nlayer> *> conns;                                       // all connections of the particle (include self)
-    std::vector<Particle<nlayer> *> neighbors_nonlocal;                          // nonlocal neighbors
+    std::vector<int> conn_slot;                                                  // position of the particle in the conn list of each of its conns
     std::vector<double> stress, strain;                                          // stress and strain tensor
 
-    Particle(const int &p_id) : cell{LatticeType::SimpleCubic3D, 0} { id = p_id; };
+    Particle(const int &p_id) : cell{LatticeType::SimpleCubic3D, 0} { id = id_initial = p_id; };
     Particle(const double &p_x, const double &p_y, const double &p_z, const UnitCell &p_cell, const int &p_type);
     Particle(const double &p_x, const double &p_y, const double &p_z, const LatticeType &p_lattice, const double &p_radius);
     Particle(const double &p_x, const double &p_y, const double &p_z, const UnitCell &p_cell);
@@ -51,11 +60,14 @@ public:
 
     void updateParticleForce();
     void updateParticleStress();
+    void updateParticleForceStress();
     void updateBondsGeometry();
     void updateParticleDamageVisual();
     void storeParticleStateVariables();
     void resetParticleStateVariables();
     void resumeParticleState();
+    std::array<double, NDIM> updateParticleForceTangent(const BondTangent<nlayer> &bt);
+    void clearBondsTangent(BondTangent<nlayer> &bt);
 
     // virtual functions that can be inherited
     virtual void updateBondsForce() {}
@@ -63,6 +75,8 @@ public:
     virtual bool updateParticleStaticDamage() { return false; }
     virtual bool updateParticleFatigueDamage(double &dt) { return false; }
     virtual bool updateParticleBrokenBonds() { return false; };
+    virtual void updateBondsTangent(const std::vector<int> &seed, BondTangent<nlayer> &bt); // materials with another bond force law have to override it
+    virtual bool plasticTangent(std::array<std::array<double, 2 * NDIM>, 2 * NDIM> & /*dep_dsigma*/, std::array<double, 2 * NDIM> & /*dplstrain*/) { return false; } // last return mapping, false if elastic
 };
 
 template <int nlayer>
@@ -77,6 +91,7 @@ Particle<nlayer>::Particle(const double &p_x, const double &p_y, const double &p
     xyz_last = xyz;
     type = p_type;
     id = _ID++;
+    id_initial = id;
 }
 
 template <int nlayer>
@@ -87,6 +102,7 @@ Particle<nlayer>::Particle(const double &p_x, const double &p_y, const double &p
     xyz_initial = xyz;
     xyz_last = xyz;
     id = _ID++;
+    id_initial = id;
 }
 
 template <int nlayer>
@@ -97,6 +113,7 @@ Particle<nlayer>::Particle(const double &p_x, const double &p_y, const double &p
     xyz_initial = xyz;
     xyz_last = xyz;
     id = _ID++;
+    id_initial = id;
 }
 
 template <int nlayer>
@@ -108,6 +125,7 @@ bool Particle<nlayer>::operator==(const Particle<nlayer> &other)
 template <int nlayer>
 void Particle<nlayer>::storeParticleStateVariables()
 {
+    BondStore<nlayer> &bs = *bonds;
     // set the last converged state variables to be the current one
     damage_last = damage;
     for (int i = 0; i < state_var.size(); ++i)
@@ -115,12 +133,12 @@ void Particle<nlayer>::storeParticleStateVariables()
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : bond_layers[i])
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
         {
-            bd->dis_last = bd->dis;
-            bd->bdamage_last = bd->bdamage;
-            bd->bforce_last = bd->bforce;
-            bd->dLp_last = bd->dLp;
+            bs.dis_last[bd] = bs.dis[bd];
+            bs.bdamage_last[bd] = bs.bdamage[bd];
+            bs.bforce_last[bd] = bs.bforce[bd];
+            bs.dLp_last[bd] = bs.dLp[bd];
         }
     }
 }
@@ -128,6 +146,7 @@ void Particle<nlayer>::storeParticleStateVariables()
 template <int nlayer>
 void Particle<nlayer>::resetParticleStateVariables()
 {
+    BondStore<nlayer> &bs = *bonds;
     // reset back the current state variables to the last converged one
     damage = damage_last;
     for (int i = 0; i < state_var.size(); ++i)
@@ -135,14 +154,14 @@ void Particle<nlayer>::resetParticleStateVariables()
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : bond_layers[i])
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
         {
-            bd->dis = bd->dis_last;
-            bd->bdamage = bd->bdamage_last;
-            bd->bforce = bd->bforce_last;
-            bd->dLp = bd->dLp_last;
+            bs.dis[bd] = bs.dis_last[bd];
+            bs.bdamage[bd] = bs.bdamage_last[bd];
+            bs.bforce[bd] = bs.bforce_last[bd];
+            bs.dLp[bd] = bs.dLp_last[bd];
             // if (id == 5145)
-            //     printf("bstrain %f \n", bd->bstrain);
+            //     printf("bstrain %f \n", bs.bstrain[bd]);
         }
     }
 }
@@ -150,11 +169,12 @@ void Particle<nlayer>::resetParticleStateVariables()
 template <int nlayer>
 void Particle<nlayer>::updateParticleDamageVisual()
 {
+    BondStore<nlayer> &bs = *bonds;
     damage_visual = 0;
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : bond_layers[i])
-            damage_visual += bd->bdamage;
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
+            damage_visual += bs.bdamage[bd];
     }
 
     damage_visual = damage_visual / (double)neighbors.size();
@@ -163,19 +183,20 @@ void Particle<nlayer>::updateParticleDamageVisual()
 template <int nlayer>
 void Particle<nlayer>::updateBondsGeometry()
 {
+    BondStore<nlayer> &bs = *bonds;
     // update all the neighbors information
     for (int i = 0; i < nlayer; ++i)
     {
         dLe_total[i] = 0, TdLe_total[i] = 0;
         cs_sumx[i] = 0, cs_sumy[i] = 0, cs_sumz[i] = 0;
-        for (Bond<nlayer> *bd : bond_layers[i])
+        bs.updateGeometry(bond_ptr[i], bond_ptr[i + 1], this);
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
         {
-            bd->updatebGeometry();
-            dLe_total[i] += bd->dLe;
-            TdLe_total[i] += bd->Tv * bd->dLe;
-            cs_sumx[i] += bd->csx;
-            cs_sumy[i] += bd->csy;
-            cs_sumz[i] += bd->csz;
+            dLe_total[i] += bs.dLe[bd];
+            TdLe_total[i] += bs.Tv[bd] * bs.dLe[bd];
+            cs_sumx[i] += bs.csx[bd];
+            cs_sumy[i] += bs.csy[bd];
+            cs_sumz[i] += bs.csz[bd];
         }
     }
 }
@@ -184,32 +205,89 @@ template <int nlayer>
 void Particle<nlayer>::resumeParticleState()
 {
     // this function is mainly for calculating stiffness matrix by finite difference
+    // the state variables are reset before the geometry, so that dLe does not keep the plastic stretch of the perturbation
     for (Particle<nlayer> *pjj : conns)
     {
-        pjj->updateBondsGeometry(); // update all bond information, e.g., dL, dL_total
         pjj->resetParticleStateVariables();
+        pjj->updateBondsGeometry(); // update all bond information, e.g., dL, dL_total
     }
 
     for (Particle<nlayer> *pjj : conns)
         pjj->updateBondsForce(); // update all bond forces
 }
 
+template <int nlayer>
+void Particle<nlayer>::updateBondsTangent(const std::vector<int> &seed, BondTangent<nlayer> &bt)
+{
+    // updateBondsGeometry and the elastic damaged bond force of updateBondsForce with dual coordinates, seed[id] is the
+    // seeded direction of a particle (-1 if it is not seeded), damage and plastic stretch are kept fixed
+    BondStore<nlayer> &bs = *bonds;
+    std::array<Dual, NDIM> x1;
+    for (int d = 0; d < NDIM; ++d)
+        x1[d] = Dual(xyz[d], seed[id] == d ? 1.0 : 0.0);
+
+    for (int i = 0; i < nlayer; ++i)
+    {
+        Dual dLe_total{0};
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
+        {
+            Particle<nlayer> *p2 = bs.p2[bd];
+            Dual x2{p2->xyz[0], seed[p2->id] == 0 ? 1.0 : 0.0}, y2{p2->xyz[1], seed[p2->id] == 1 ? 1.0 : 0.0}, z2{p2->xyz[2], seed[p2->id] == 2 ? 1.0 : 0.0};
+            Dual dis, bstrain, dLe, csx, csy, csz;
+            bondGeometryOne(0, x1.data(), &x2, &y2, &z2, &bs.dis_initial[bd], &bs.dLp[bd], &bs.bdamage[bd], &dis, &bstrain, &dLe, &csx, &csy, &csz);
+            bt.dLe[bd] = dLe.d;
+            bt.csx[bd] = csx.d, bt.csy[bd] = csy.d, bt.csz[bd] = csz.d;
+            dLe_total += dLe;
+        }
+
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
+        {
+            Dual dLe{bs.dLe[bd], bt.dLe[bd]}, bforce;
+            bondForceOne(0, &bs.Kn[bd], &bs.Tv[bd], &dLe, dLe_total, &bs.bdamage[bd], &bforce);
+            bt.bforce[bd] = bforce.d;
+        }
+    }
+}
+
+template <int nlayer>
+std::array<double, NDIM> Particle<nlayer>::updateParticleForceTangent(const BondTangent<nlayer> &bt)
+{
+    // updateParticleForce with dual bond forces, returns the derivative of Pin
+    BondStore<nlayer> &bs = *bonds;
+    std::array<Dual, NDIM> Pin_dual;
+    for (int i = 0; i < nlayer; ++i)
+    {
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
+        {
+            Dual bforce_sum = Dual(bs.bforce[bd], bt.bforce[bd]) + Dual(bs.bforce[bs.op[bd]], bt.bforce[bs.op[bd]]);
+            Pin_dual[0] += Dual(bs.csx[bd], bt.csx[bd]) * 0.5 * bforce_sum;
+            Pin_dual[1] += Dual(bs.csy[bd], bt.csy[bd]) * 0.5 * bforce_sum;
+            Pin_dual[2] += Dual(bs.csz[bd], bt.csz[bd]) * 0.5 * bforce_sum;
+        }
+    }
+    return {Pin_dual[0].d, Pin_dual[1].d, Pin_dual[2].d};
+}
+
+template <int nlayer>
+void Particle<nlayer>::clearBondsTangent(BondTangent<nlayer> &bt)
+{
+    for (int bd = bond_ptr[0]; bd < bond_ptr[nlayer]; ++bd)
+        bt.dLe[bd] = 0, bt.csx[bd] = 0, bt.csy[bd] = 0, bt.csz[bd] = 0, bt.bforce[bd] = 0;
+}
+
 template <int nlayer>
 void Particle<nlayer>::updateParticleForce()
 {
+    BondStore<nlayer> &bs = *bonds;
     // sum up all bond forces
     Pin = {0., 0., 0.};
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : bond_layers[i])
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
         {
-            // find the opposite bond
-            auto op_bd = std::find_if(bd->p2->bond_layers[i].begin(), bd->p2->bond_layers[i].end(),
-                                      [&](Bond<nlayer> *b)
-                                      { return b->p2->id == id; });
-            Pin[0] += bd->csx * 0.5 * (bd->bforce + (*op_bd)->bforce);
-            Pin[1] += bd->csy * 0.5 * (bd->bforce + (*op_bd)->bforce);
-            Pin[2] += bd->csz * 0.5 * (bd->bforce + (*op_bd)->bforce);
+            Pin[0] += bs.csx[bd] * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]);
+            Pin[1] += bs.csy[bd] * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]);
+            Pin[2] += bs.csz[bd] * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]);
         }
     }
 }
@@ -217,6 +295,7 @@ void Particle<nlayer>::updateParticleForce()
 template <int nlayer>
 void Particle<nlayer>::updateParticleStress()
 {
+    BondStore<nlayer> &bs = *bonds;
     // initialize the tensor
     stress = std::vector<double>(2 * NDIM, 0.0);
 
@@ -224,31 +303,62 @@ void Particle<nlayer>::updateParticleStress()
     double V_m = cell.particle_volume * nb / cell.nneighbors;
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : bond_layers[i])
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
+        {
+            stress[0] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]) * (bs.csx[bd]) * (bs.csx[bd]);
+            stress[1] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]) * (bs.csy[bd]) * (bs.csy[bd]);
+            stress[2] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]) * (bs.csz[bd]) * (bs.csz[bd]);
+            stress[3] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]) * (bs.csy[bd]) * (bs.csz[bd]);
+            stress[4] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]) * (bs.csx[bd]) * (bs.csz[bd]);
+            stress[5] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * (bs.bforce[bd] + bs.bforce[bs.op[bd]]) * (bs.csx[bd]) * (bs.csy[bd]);
+        }
+    }
+}
+
+template <int nlayer>
+void Particle<nlayer>::updateParticleForceStress()
+{
+    // updateParticleForce, updateParticleStress and updateParticleDamageVisual in one sweep over the bonds
+    BondStore<nlayer> &bs = *bonds;
+    Pin = {0., 0., 0.};
+    stress = std::vector<double>(2 * NDIM, 0.0);
+    damage_visual = 0;
+
+    double V_m = cell.particle_volume * nb / cell.nneighbors;
+    for (int i = 0; i < nlayer; ++i)
+    {
+        for (int bd = bond_ptr[i]; bd < bond_ptr[i + 1]; ++bd)
         {
-            auto op_bd = std::find_if(bd->p2->bond_layers[i].begin(), bd->p2->bond_layers[i].end(),
-                                      [&](Bond<nlayer> *b)
-                                      { return b->p2->id == id; });
-            stress[0] += 0.5 / V_m * (bd->dis) * 0.5 * (bd->bforce + (*op_bd)->bforce) * (bd->csx) * (bd->csx);
-            stress[1] += 0.5 / V_m * (bd->dis) * 0.5 * (bd->bforce + (*op_bd)->bforce) * (bd->csy) * (bd->csy);
-            stress[2] += 0.5 / V_m * (bd->dis) * 0.5 * (bd->bforce + (*op_bd)->bforce) * (bd->csz) * (bd->csz);
-            stress[3] += 0.5 / V_m * (bd->dis) * 0.5 * (bd->bforce + (*op_bd)->bforce) * (bd->csy) * (bd->csz);
-            stress[4] += 0.5 / V_m * (bd->dis) * 0.5 * (bd->bforce + (*op_bd)->bforce) * (bd->csx) * (bd->csz);
-            stress[5] += 0.5 / V_m * (bd->dis) * 0.5 * (bd->bforce + (*op_bd)->bforce) * (bd->csx) * (bd->csy);
+            double bforce_sum = bs.bforce[bd] + bs.bforce[bs.op[bd]];
+            Pin[0] += bs.csx[bd] * 0.5 * bforce_sum;
+            Pin[1] += bs.csy[bd] * 0.5 * bforce_sum;
+            Pin[2] += bs.csz[bd] * 0.5 * bforce_sum;
+
+            stress[0] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * bforce_sum * (bs.csx[bd]) * (bs.csx[bd]);
+            stress[1] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * bforce_sum * (bs.csy[bd]) * (bs.csy[bd]);
+            stress[2] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * bforce_sum * (bs.csz[bd]) * (bs.csz[bd]);
+            stress[3] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * bforce_sum * (bs.csy[bd]) * (bs.csz[bd]);
+            stress[4] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * bforce_sum * (bs.csx[bd]) * (bs.csz[bd]);
+            stress[5] += 0.5 / V_m * (bs.dis[bd]) * 0.5 * bforce_sum * (bs.csx[bd]) * (bs.csy[bd]);
+
+            damage_visual += bs.bdamage[bd];
         }
     }
+
+    damage_visual = damage_visual / (double)neighbors.size();
 }
 
 template <int nlayer>
 bool Particle<nlayer>::hasAFEMneighbor(Particle<nlayer> *pj, int layer)
 {
-    for (Bond<nlayer> *bd1 : bond_layers[layer])
+    BondStore<nlayer> &bs = *bonds;
+    for (int bd1 = bond_ptr[layer]; bd1 < bond_ptr[layer + 1]; ++bd1)
     {
-        if (bd1->p2->id == pj->id)
+        if (bs.p2[bd1]->id == pj->id)
             return true;
-        for (Bond<nlayer> *bd2 : bd1->p2->bond_layers[layer])
+        for (int bd2 = bs.p2[bd1]->bond_ptr[layer]; bd2 < bs.p2[bd1]->bond_ptr[layer + 1]; ++bd2)
         {
-            if (bd2->p2->id == pj->id)
+            if (bs.p2[bd2]->id == pj->id)
                 return true;
         }
     }
@@ -0,0 +1,154 @@
+#pragma once
+#ifndef PARTICLE_ARENA_H
+#define PARTICLE_ARENA_H
+
+#include <vector>
+#include <utility>
+
+#include "lpm.h"
+#include "particle_elastic.h"
+#include "particle_elastic_damage.h"
+#include "particle_fatigue_hcf.h"
+#include "particle_j2plasticity.h"
+
+// Pool that constructs objects of one type in contiguous blocks
+// An object never moves once created, so raw pointers to it stay valid until the pool is destroyed
+
+template <typename T>
+class Pool
+{
+public:
+    int block_size{1024};               // default capacity of a new block
+    std::vector<std::vector<T>> blocks; // each block is filled up to its capacity, and never reallocated
+
+    void reserve(int n);
+    template <typename... Args>
+    T *create(Args &&...args);
+    template <typename F>
+    void forEach(F f);
+    template <typename F>
+    bool forEachAny(F f);
+};
+
+template <typename T>
+void Pool<T>::reserve(int n)
+{
+    // make sure the next n objects are created in one block
+    if (blocks.empty() || (int)(blocks.back().capacity() - blocks.back().size()) < n)
+    {
+        blocks.emplace_back();
+        blocks.back().reserve(std::max(n, block_size));
+    }
+}
+
+template <typename T>
+template <typename... Args>
+T *Pool<T>::create(Args &&...args)
+{
+    reserve(1);
+    blocks.back().emplace_back(std::forward<Args>(args)...);
+    return &blocks.back().back();
+}
+
+template <typename T>
+template <typename F>
+void Pool<T>::forEach(F f)
+{
+    for (std::vector<T> &block : blocks)
+    {
+#pragma omp parallel for
+        for (int i = 0; i < (int)block.size(); ++i)
+            f(block[i]);
+    }
+}
+
+template <typename T>
+template <typename F>
+bool Pool<T>::forEachAny(F f)
+{
+    // f is applied to every object (no short circuit), returns true if any call returns true
+    bool any{false};
+    for (std::vector<T> &block : blocks)
+    {
+#pragma omp parallel for reduction(|| : any)
+        for (int i = 0; i < (int)block.size(); ++i)
+            any = f(block[i]) || any;
+    }
+    return any;
+}
+
+// Particle storage of an assembly, particles of the same material are laid out contiguously
+// forEach and forEachAny visit the particles through their concrete (final) material type, so the material
+// hooks are called directly and can be inlined instead of going through the virtual table
+
+template <int nlayer>
+class ParticleArena
+{
+public:
+    Pool<ParticleElastic<nlayer>> elastic;
+    Pool<ParticleElasticDamage<nlayer>> elastic_damage;
+    Pool<ParticleJ2Plasticity<nlayer>> j2plasticity;
+    Pool<ParticleFatigueHCF<nlayer>> fatigue_hcf;
+
+    void reserve(const ParticleType &p_ptype, int n);
+    template <typename... Args>
+    Particle<nlayer> *create(const ParticleType &p_ptype, Args &&...args);
+    template <typename F>
+    void forEach(F f);
+    template <typename F>
+    bool forEachAny(F f);
+};
+
+template <int nlayer>
+void ParticleArena<nlayer>::reserve(const ParticleType &p_ptype, int n)
+{
+    if (p_ptype == ParticleType::Elastic)
+        elastic.reserve(n);
+    if (p_ptype == ParticleType::ElasticDamage)
+        elastic_damage.reserve(n);
+    if (p_ptype == ParticleType::J2Plasticity)
+        j2plasticity.reserve(n);
+    if (p_ptype == ParticleType::FatigueHCF)
+        fatigue_hcf.reserve(n);
+}
+
+template <int nlayer>
+template <typename... Args>
+Particle<nlayer> *ParticleArena<nlayer>::create(const ParticleType &p_ptype, Args &&...args)
+{
+    Particle<nlayer> *pt = nullptr;
+    if (p_ptype == ParticleType::Elastic)
+        pt = elastic.create(std::forward<Args>(args)...);
+    if (p_ptype == ParticleType::ElasticDamage)
+        pt = elastic_damage.create(std::forward<Args>(args)...);
+    if (p_ptype == ParticleType::J2Plasticity)
+        pt = j2plasticity.create(std::forward<Args>(args)...);
+    if (p_ptype == ParticleType::FatigueHCF)
+        pt = fatigue_hcf.create(std::forward<Args>(args)...);
+
+    return pt;
+}
+
+template <int nlayer>
+template <typename F>
+void ParticleArena<nlayer>::forEach(F f)
+{
+    elastic.forEach(f);
+    elastic_damage.forEach(f);
+    j2plasticity.forEach(f);
+    fatigue_hcf.forEach(f);
+}
+
+template <int nlayer>
+template <typename F>
+bool ParticleArena<nlayer>::forEachAny(F f)
+{
+    bool any{false};
+    any = elastic.forEachAny(f) || any;
+    any = elastic_damage.forEachAny(f) || any;
+    any = j2plasticity.forEachAny(f) || any;
+    any = fatigue_hcf.forEachAny(f) || any;
+    return any;
+}
+
+#endif
@@ -13,7 +13,7 @@
 // implement bond-based damage model
 
 template <int nlayer>
-class ParticleElastic : public Particle<nlayer>
+class ParticleElastic final : public Particle<nlayer>
 {
     double critical_bstrain{0};
 
@@ -38,29 +38,25 @@ public:
 template <int nlayer>
 void ParticleElastic<nlayer>::updateBondsForce()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     // for elastic bonds, a trial elastic calculation is enough
     for (int i = 0; i < nlayer; ++i)
-    {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
-        {
-            bd->bforce = 2. * bd->Kn * bd->dLe + 2. * bd->Tv * this->dLe_total[bd->layer];
-            bd->bforce *= (1.0 - bd->bdamage);
-        }
-    }
+        bs.updateForce(this->bond_ptr[i], this->bond_ptr[i + 1], this->dLe_total[i]);
 }
 
 template <int nlayer>
 bool ParticleElastic<nlayer>::updateParticleStaticDamage()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     bool any_broken{false};
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
-            if (bd->bstrain >= critical_bstrain && abs(bd->bdamage - 1.0) > EPS)
+            if (bs.bstrain[bd] >= critical_bstrain && abs(bs.bdamage[bd] - 1.0) > EPS)
             {
                 any_broken = any_broken || true;
-                bd->bdamage = 1;
+                bs.bdamage[bd] = 1;
             }
         }
     }
@@ -70,6 +66,7 @@ bool ParticleElastic<nlayer>::updateParticleStaticDamage()
 template <int nlayer>
 void ParticleElastic<nlayer>::setParticleProperty(double p_nonlocalL, bool is_plane_stress, double p_E, double p_mu, double p_critical_bstrain)
 {
+    BondStore<nlayer> &bs = *this->bonds;
     critical_bstrain = p_critical_bstrain;
     this->nonlocal_L = p_nonlocalL;
 
@@ -91,17 +88,17 @@ void ParticleElastic<nlayer>::setParticleProperty(double p_nonlocalL, bool is_pl
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
             if (this->cell.lattice == LatticeType::Hexagon2D)
             {
-                bd->Kn = KnTv[0];
-                bd->Tv = KnTv[1];
+                bs.Kn[bd] = KnTv[0];
+                bs.Tv[bd] = KnTv[1];
             }
             else
             {
-                bd->Kn = KnTv[bd->layer]; // layer is 0 or 1
-                bd->Tv = KnTv[2];
+                bs.Kn[bd] = KnTv[i]; // layer is 0 or 1
+                bs.Tv[bd] = KnTv[2];
             }
         }
     }
@@ -110,6 +107,7 @@ void ParticleElastic<nlayer>::setParticleProperty(double p_nonlocalL, bool is_pl
 template <int nlayer>
 void ParticleElastic<nlayer>::setParticleProperty(double p_nonlocalL, double p_C11, double p_C12, double p_C44, double p_critical_bstrain)
 {
+    BondStore<nlayer> &bs = *this->bonds;
     critical_bstrain = p_critical_bstrain;
     this->nonlocal_L = p_nonlocalL;
 
@@ -123,17 +121,17 @@ void ParticleElastic<nlayer>::setParticleProperty(double p_nonlocalL, double p_C
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
             if (this->cell.lattice == LatticeType::Hexagon2D)
             {
-                bd->Kn = KnTv[0];
-                bd->Tv = KnTv[1];
+                bs.Kn[bd] = KnTv[0];
+                bs.Tv[bd] = KnTv[1];
             }
             else
             {
-                bd->Kn = KnTv[bd->layer]; // layer is 0 or 1
-                bd->Tv = KnTv[2];
+                bs.Kn[bd] = KnTv[i]; // layer is 0 or 1
+                bs.Tv[bd] = KnTv[2];
             }
         }
     }
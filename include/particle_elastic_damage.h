@@ -22,7 +22,7 @@
 // 3. update bforce (after calculating the bdamage of all bonds)
 
 template <int nlayer>
-class ParticleElasticDamage : public Particle<nlayer>
+class ParticleElasticDamage final : public Particle<nlayer>
 {
 public:
     double k0{0}, k1{0}; // damage parameters
@@ -55,15 +55,16 @@ public:
 template <int nlayer>
 bool ParticleElasticDamage<nlayer>::updateParticleBrokenBonds()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     bool any_broken{false};
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
-            if (abs(bd->bdamage - 1.0) > EPS)
+            if (abs(bs.bdamage[bd] - 1.0) > EPS)
             {
                 any_broken = any_broken || true;
-                bd->bdamage = 1;
+                bs.bdamage[bd] = 1;
                 //--(this->nb);
             }
         }
@@ -74,28 +75,28 @@ bool ParticleElasticDamage<nlayer>::updateParticleBrokenBonds()
 template <int nlayer>
 void ParticleElasticDamage<nlayer>::updateBondsForce()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     // calculate the current bond force using current damage value
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
-        {
-            bd->bforce = 2. * bd->Kn * bd->dLe + 2. * bd->Tv * this->dLe_total[bd->layer]; // trial elastic bforce
-            bd->bdamage = std::max(bd->bdamage, std::max(this->damage, bd->p2->damage));   // update the bond-wise damage
-            bd->bforce *= (1.0 - bd->bdamage);
-        }
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
+            bs.bdamage[bd] = std::max(bs.bdamage[bd], std::max(this->damage, bs.p2[bd]->damage)); // update the bond-wise damage
+
+        bs.updateForce(this->bond_ptr[i], this->bond_ptr[i + 1], this->dLe_total[i]); // elastic bforce reduced by the damage
     }
 }
 
 template <int nlayer>
 double ParticleElasticDamage<nlayer>::calcStrainEnergyDensity()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     // compute energy terms
     double V_m = this->cell.particle_volume * this->nb / this->cell.nneighbors; // modified particle volume
     double energy_total{0};
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
-            energy_total += 0.5 * (bd->Kn * bd->dLe * bd->dLe) / V_m; // first add spring energy
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
+            energy_total += 0.5 * (bs.Kn[bd] * bs.dLe[bd] * bs.dLe[bd]) / V_m; // first add spring energy
 
         energy_total += 0.5 * this->TdLe_total[i] * this->dLe_total[i] / V_m; // then add volumetric energy
     }
@@ -135,13 +136,14 @@ double func_eq_strain(const double &comp_tensile_ratio, const double &I1, const
 template <int nlayer>
 double ParticleElasticDamage<nlayer>::calcEqStrain()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     double I1{0}, J2{0};
     for (int i = 0; i < nlayer; ++i)
     {
         double bl = this->cell.neighbor_cutoff[i]; // bond length of the current layer
         I1 += this->dLe_total[i] / bl;
-        for (Bond<nlayer> *bd : this->bond_layers[i])
-            J2 += bd->bstrain * bd->bstrain;
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
+            J2 += bs.bstrain[bd] * bs.bstrain[bd];
     }
     J2 = 0.5 * I1 * I1 / this->nb - 0.5 * J2;
     return func_eq_strain(comp_tensile_ratio, I1, J2);
@@ -175,6 +177,7 @@ bool ParticleElasticDamage<nlayer>::updateParticleStaticDamage()
 template <int nlayer>
 void ParticleElasticDamage<nlayer>::setParticleProperty(double p_nonlocalL, bool is_plane_stress, double p_E, double p_mu, double p_k0, double p_k1, double p_ct_ratio, double p_d_thres)
 {
+    BondStore<nlayer> &bs = *this->bonds;
     k0 = p_k0;
     k1 = p_k1;
     damage_threshold = p_d_thres;
@@ -199,17 +202,17 @@ void ParticleElasticDamage<nlayer>::setParticleProperty(double p_nonlocalL, bool
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
             if (this->cell.lattice == LatticeType::Hexagon2D)
             {
-                bd->Kn = KnTv[0];
-                bd->Tv = KnTv[1];
+                bs.Kn[bd] = KnTv[0];
+                bs.Tv[bd] = KnTv[1];
             }
             else
             {
-                bd->Kn = KnTv[bd->layer]; // layer is 0 or 1
-                bd->Tv = KnTv[2];
+                bs.Kn[bd] = KnTv[i]; // layer is 0 or 1
+                bs.Tv[bd] = KnTv[2];
             }
         }
     }
@@ -218,6 +221,7 @@ void ParticleElasticDamage<nlayer>::setParticleProperty(double p_nonlocalL, bool
 template <int nlayer>
 void ParticleElasticDamage<nlayer>::setParticleProperty(double p_nonlocalL, double p_C11, double p_C12, double p_C44, double p_k0, double p_k1, double p_ct_ratio, double p_d_thres)
 {
+    BondStore<nlayer> &bs = *this->bonds;
     k0 = p_k0;
     k1 = p_k1;
     damage_threshold = p_d_thres;
@@ -233,17 +237,17 @@ void ParticleElasticDamage<nlayer>::setParticleProperty(double p_nonlocalL, doub
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
             if (this->cell.lattice == LatticeType::Hexagon2D)
             {
-                bd->Kn = KnTv[0];
-                bd->Tv = KnTv[1];
+                bs.Kn[bd] = KnTv[0];
+                bs.Tv[bd] = KnTv[1];
             }
             else
             {
-                bd->Kn = KnTv[bd->layer]; // layer is 0 or 1
-                bd->Tv = KnTv[2];
+                bs.Kn[bd] = KnTv[i]; // layer is 0 or 1
+                bs.Tv[bd] = KnTv[2];
             }
         }
     }
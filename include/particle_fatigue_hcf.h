@@ -15,7 +15,7 @@
 // Three particle-wise state variables: [0]his_max_energy, [1]min_energy, [2]max_energy
 
 template <int nlayer>
-class ParticleFatigueHCF : public Particle<nlayer>
+class ParticleFatigueHCF final : public Particle<nlayer>
 {
 public:
     double A{0}, B{0}, d{0};
@@ -47,15 +47,16 @@ public:
 template <int nlayer>
 bool ParticleFatigueHCF<nlayer>::updateParticleBrokenBonds()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     bool any_broken{false};
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
-            if (abs(bd->bdamage - 1.0) > EPS)
+            if (abs(bs.bdamage[bd] - 1.0) > EPS)
             {
                 any_broken = any_broken || true;
-                bd->bdamage = 1;
+                bs.bdamage[bd] = 1;
             }
         }
     }
@@ -65,30 +66,32 @@ bool ParticleFatigueHCF<nlayer>::updateParticleBrokenBonds()
 template <int nlayer>
 void ParticleFatigueHCF<nlayer>::updateBondsForce()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     // calculate the current bond force using current damage value
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
-            bd->bforce = 2. * bd->Kn * bd->dLe + 2. * bd->Tv * this->dLe_total[bd->layer]; // trial elastic bforce
-            bd->bdamage = std::max(bd->bdamage, std::max(this->damage, bd->p2->damage));   // update the bond-wise damage
-            // if (abs(this->damage - 1.0) < EPS || abs(bd->p2->damage - 1.0) < EPS)
-            //     bd->bdamage = 1; // update the bond-wise damage
-            bd->bforce *= (1.0 - bd->bdamage);
+            bs.bdamage[bd] = std::max(bs.bdamage[bd], std::max(this->damage, bs.p2[bd]->damage)); // update the bond-wise damage
+            // if (abs(this->damage - 1.0) < EPS || abs(bs.p2[bd]->damage - 1.0) < EPS)
+            //     bs.bdamage[bd] = 1; // update the bond-wise damage
         }
+
+        bs.updateForce(this->bond_ptr[i], this->bond_ptr[i + 1], this->dLe_total[i]); // elastic bforce reduced by the damage
     }
 }
 
 template <int nlayer>
 double ParticleFatigueHCF<nlayer>::calcEqEnergy()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     // compute dilatational stretch for each layer
     std::vector<double> dLe_dil(nlayer, 0);
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
-            dLe_dil[i] += bd->dLe;
-        dLe_dil[i] /= this->bond_layers[i].size();
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
+            dLe_dil[i] += bs.dLe[bd];
+        dLe_dil[i] /= (this->bond_ptr[i + 1] - this->bond_ptr[i]);
     }
 
     // compute energy terms
@@ -96,11 +99,11 @@ double ParticleFatigueHCF<nlayer>::calcEqEnergy()
     double energy_total{0}, energy_dil{0}, energy_dis{0}, energy_uni{0};
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
-            double dLe_dis = bd->dLe - dLe_dil[i];
-            energy_dis += 0.5 * (bd->Kn * dLe_dis * dLe_dis) / V_m;
-            energy_total += 0.5 * (bd->Kn * bd->dLe * bd->dLe) / V_m; // first add spring energy
+            double dLe_dis = bs.dLe[bd] - dLe_dil[i];
+            energy_dis += 0.5 * (bs.Kn[bd] * dLe_dis * dLe_dis) / V_m;
+            energy_total += 0.5 * (bs.Kn[bd] * bs.dLe[bd] * bs.dLe[bd]) / V_m; // first add spring energy
         }
         energy_total += 0.5 * this->TdLe_total[i] * this->dLe_total[i] / V_m; // then add volumetric energy
     }
@@ -162,6 +165,7 @@ bool ParticleFatigueHCF<nlayer>::updateParticleFatigueDamage(double &dt)
 template <int nlayer>
 void ParticleFatigueHCF<nlayer>::setParticleProperty(double p_nonlocalL, bool is_plane_stress, double p_E, double p_mu, double p_A, double p_B, double p_d, double p_d_thres, double p_f_lmt_ratio)
 {
+    BondStore<nlayer> &bs = *this->bonds;
     E = p_E;
     mu = p_mu;
     A = p_A;
@@ -189,17 +193,17 @@ void ParticleFatigueHCF<nlayer>::setParticleProperty(double p_nonlocalL, bool is
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
             if (this->cell.lattice == LatticeType::Hexagon2D)
             {
-                bd->Kn = KnTv[0];
-                bd->Tv = KnTv[1];
+                bs.Kn[bd] = KnTv[0];
+                bs.Tv[bd] = KnTv[1];
             }
             else
             {
-                bd->Kn = KnTv[bd->layer]; // layer is 0 or 1
-                bd->Tv = KnTv[2];
+                bs.Kn[bd] = KnTv[i]; // layer is 0 or 1
+                bs.Tv[bd] = KnTv[2];
             }
         }
     }
@@ -15,11 +15,14 @@
 ////// alpha, beta[2*NDIM]
 
 template <int nlayer>
-class ParticleJ2Plasticity : public Particle<nlayer>
+class ParticleJ2Plasticity final : public Particle<nlayer>
 {
 public:
     double E{0}, mu{0}, sigmay{0}, xi{0}, H{0}, A{0};
     double damage_threshold{0}, critical_bstrain{0};
+    bool plastic_loading{false};                                    // the last return mapping was plastic
+    std::array<std::array<double, 2 * NDIM>, 2 * NDIM> dep_dsigma{}; // algorithmic tangent of the last return mapping
+    std::array<double, 2 * NDIM> dplstrain_last{};                   // plastic strain increment of the last return mapping
 
     ParticleJ2Plasticity(const double &p_x, const double &p_y, const double &p_z, const UnitCell &p_cell) : Particle<nlayer> { p_x, p_y, p_z, p_cell }
     {
@@ -35,6 +38,7 @@ public:
 
     void updateParticleStateVariables();
     bool updateParticleStaticDamage();
+    bool plasticTangent(std::array<std::array<double, 2 * NDIM>, 2 * NDIM> &p_dep_dsigma, std::array<double, 2 * NDIM> &p_dplstrain);
     bool updateParticleBrokenBonds();
 
     void updateBondsForce();
@@ -44,15 +48,16 @@ public:
 template <int nlayer>
 bool ParticleJ2Plasticity<nlayer>::updateParticleBrokenBonds()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     bool any_broken{false};
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
-            if (abs(bd->bdamage - 1.0) > EPS)
+            if (abs(bs.bdamage[bd] - 1.0) > EPS)
             {
                 any_broken = any_broken || true;
-                bd->bdamage = 1;
+                bs.bdamage[bd] = 1;
                 //--(this->nb);
             }
         }
@@ -63,21 +68,21 @@ bool ParticleJ2Plasticity<nlayer>::updateParticleBrokenBonds()
 template <int nlayer>
 void ParticleJ2Plasticity<nlayer>::updateBondsForce()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     // calculate the current bond force using current damage value
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
-        {
-            bd->bforce = 2. * bd->Kn * bd->dLe + 2. * bd->Tv * this->dLe_total[bd->layer]; // trial elastic bforce
-            bd->bdamage = std::max(bd->bdamage, std::max(this->damage, bd->p2->damage));   // update the bond-wise damage
-            bd->bforce *= (1.0 - bd->bdamage);
-        }
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
+            bs.bdamage[bd] = std::max(bs.bdamage[bd], std::max(this->damage, bs.p2[bd]->damage)); // update the bond-wise damage
+
+        bs.updateForce(this->bond_ptr[i], this->bond_ptr[i + 1], this->dLe_total[i]); // elastic bforce reduced by the damage
     }
 }
 
 template <int nlayer>
 void ParticleJ2Plasticity<nlayer>::updateParticleStateVariables()
 {
+    BondStore<nlayer> &bs = *this->bonds;
     double sigma_m = 0.0, sigma_eq = 0.0, triaxiality = 0.0, dlambda = 0.0; // plastic multiplier
     std::vector<double> stress_trial = this->stress;                        // trial stress tensor
     std::vector<double> dplstrain(2 * NDIM, 0.0);                           // delta plastic strain
@@ -109,6 +114,26 @@ void ParticleJ2Plasticity<nlayer>::updateParticleStateVariables()
 
     this->state_var[0] += dlambda;
 
+    /* algorithmic tangent of the radial return, with n = 1.5 * s / sigma_eq and P the deviatoric projection */
+    /* d(dplstrain) = [n (x) n / (3G + H) + dlambda * 1.5 / sigma_eq * (P - 2/3 n (x) n)] : d(stress), shear counts twice in ":" */
+    plastic_loading = dlambda > 0.0;
+    if (plastic_loading)
+    {
+        const double w[2 * NDIM]{1, 1, 1, 2, 2, 2};
+        double n[2 * NDIM];
+        for (int j = 0; j < 2 * NDIM; j++)
+            n[j] = 1.5 * stress_trial[j] / sigma_eq;
+
+        for (int j = 0; j < 2 * NDIM; j++)
+        {
+            for (int k = 0; k < 2 * NDIM; k++)
+            {
+                double P = (j == k ? 1.0 : 0.0) - (j < NDIM && k < NDIM ? 1.0 / 3.0 : 0.0);
+                dep_dsigma[j][k] = n[j] * w[k] * n[k] / (3 * G + H) + dlambda * 1.5 / sigma_eq * (P - 2.0 / 3.0 * n[j] * w[k] * n[k]);
+            }
+        }
+    }
+
     /* incremental plastic strain tensor */
     for (int j = 0; j < 2 * NDIM; j++)
     {
@@ -117,20 +142,21 @@ void ParticleJ2Plasticity<nlayer>::updateParticleStateVariables()
             dplstrain[j] = dlambda * 1.5 * stress_trial[j] / sigma_eq;
             this->state_var[j + 1] += 2. / 3. * xi * H * dplstrain[j];
         }
+        dplstrain_last[j] = dplstrain[j];
     }
 
     /* incremental plastic bond stretch */
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
-            double ddLp = bd->dis * (dplstrain[0] * bd->csx * bd->csx +
-                                     dplstrain[1] * bd->csy * bd->csy +
-                                     dplstrain[2] * bd->csz * bd->csz +
-                                     2 * dplstrain[3] * bd->csy * bd->csz +
-                                     2 * dplstrain[4] * bd->csx * bd->csz +
-                                     2 * dplstrain[5] * bd->csx * bd->csy);
-            bd->dLp += ddLp;
+            double ddLp = bs.dis[bd] * (dplstrain[0] * bs.csx[bd] * bs.csx[bd] +
+                                     dplstrain[1] * bs.csy[bd] * bs.csy[bd] +
+                                     dplstrain[2] * bs.csz[bd] * bs.csz[bd] +
+                                     2 * dplstrain[3] * bs.csy[bd] * bs.csz[bd] +
+                                     2 * dplstrain[4] * bs.csx[bd] * bs.csz[bd] +
+                                     2 * dplstrain[5] * bs.csx[bd] * bs.csy[bd]);
+            bs.dLp[bd] += ddLp;
         }
     }
 
@@ -139,6 +165,14 @@ void ParticleJ2Plasticity<nlayer>::updateParticleStateVariables()
     this->Ddot_local = dlambda * (1.0 + A * triaxiality); // update local damage rate
 }
 
+template <int nlayer>
+bool ParticleJ2Plasticity<nlayer>::plasticTangent(std::array<std::array<double, 2 * NDIM>, 2 * NDIM> &p_dep_dsigma, std::array<double, 2 * NDIM> &p_dplstrain)
+{
+    p_dep_dsigma = dep_dsigma;
+    p_dplstrain = dplstrain_last;
+    return plastic_loading;
+}
+
 template <int nlayer>
 bool ParticleJ2Plasticity<nlayer>::updateParticleStaticDamage()
 {
@@ -154,6 +188,7 @@ bool ParticleJ2Plasticity<nlayer>::updateParticleStaticDamage()
 template <int nlayer>
 void ParticleJ2Plasticity<nlayer>::setParticleProperty(double p_nonlocalL, bool is_plane_stress, double p_E, double p_mu, double p_sigmay, double p_xi, double p_H, double p_A, double p_critical_bstrain)
 {
+    BondStore<nlayer> &bs = *this->bonds;
     E = p_E;
     mu = p_mu;
     sigmay = p_sigmay;
@@ -181,17 +216,17 @@ void ParticleJ2Plasticity<nlayer>::setParticleProperty(double p_nonlocalL, bool
 
     for (int i = 0; i < nlayer; ++i)
     {
-        for (Bond<nlayer> *bd : this->bond_layers[i])
+        for (int bd = this->bond_ptr[i]; bd < this->bond_ptr[i + 1]; ++bd)
         {
             if (this->cell.lattice == LatticeType::Hexagon2D)
             {
-                bd->Kn = KnTv[0];
-                bd->Tv = KnTv[1];
+                bs.Kn[bd] = KnTv[0];
+                bs.Tv[bd] = KnTv[1];
             }
             else
             {
-                bd->Kn = KnTv[bd->layer]; // layer is 0 or 1
-                bd->Tv = KnTv[2];
+                bs.Kn[bd] = KnTv[i]; // layer is 0 or 1
+                bs.Tv[bd] = KnTv[2];
             }
         }
     }
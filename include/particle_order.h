@@ -0,0 +1,180 @@
+#pragma once
+#ifndef PARTICLE_ORDER_H
+#define PARTICLE_ORDER_H
+
+#include <vector>
+#include <array>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+
+#include "lpm.h"
+#include "cell_list.h"
+
+// Locality-preserving orderings of a set of particle coordinates
+// The returned vector lists the original index of the particle at each new position, i.e., order[new] = old
+
+// spread the lowest 21 bits of v so that there are two zero bits between each of them
+uint64_t spreadBits3(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+std::vector<int> mortonOrder(const std::vector<std::array<double, NDIM>> &p_xyz)
+{
+    // quantize the coordinates on a 2^21 grid over the bounding box (same scale along all directions)
+    std::array<double, NDIM> lower = p_xyz[0], upper = p_xyz[0];
+    for (const std::array<double, NDIM> &x : p_xyz)
+    {
+        for (int d = 0; d < NDIM; ++d)
+        {
+            lower[d] = std::min(lower[d], x[d]);
+            upper[d] = std::max(upper[d], x[d]);
+        }
+    }
+
+    double extent = EPS;
+    for (int d = 0; d < NDIM; ++d)
+        extent = std::max(extent, upper[d] - lower[d]);
+
+    std::vector<uint64_t> key(p_xyz.size());
+#pragma omp parallel for
+    for (int i = 0; i < (int)p_xyz.size(); ++i)
+    {
+        key[i] = 0;
+        for (int d = 0; d < NDIM; ++d)
+            key[i] |= spreadBits3((uint64_t)((p_xyz[i][d] - lower[d]) / extent * 0x1fffff)) << d;
+    }
+
+    std::vector<int> order(p_xyz.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&key](int a, int b)
+                     { return key[a] < key[b]; });
+    return order;
+}
+
+// breadth-first level of every particle reachable from s (level has to be -1 for them), returns them in visiting order
+std::vector<int> levelStructure(const std::vector<std::vector<int>> &adj, int s, std::vector<int> &level)
+{
+    std::vector<int> queue{s};
+    level[s] = 0;
+    for (int head = 0; head < (int)queue.size(); ++head)
+    {
+        for (int j : adj[queue[head]])
+        {
+            if (level[j] < 0)
+            {
+                level[j] = level[queue[head]] + 1;
+                queue.push_back(j);
+            }
+        }
+    }
+    return queue;
+}
+
+std::vector<int> rcmOrder(const std::vector<std::array<double, NDIM>> &p_xyz, double cutoff)
+{
+    // reverse Cuthill-McKee on the graph of the particles closer than cutoff (the bonds)
+    int n = (int)p_xyz.size();
+    CellList cells(p_xyz, cutoff);
+
+    std::vector<std::vector<int>> adj(n);
+#pragma omp parallel
+    {
+        std::vector<int> candidates;
+#pragma omp for
+        for (int i = 0; i < n; ++i)
+        {
+            cells.findCandidates(p_xyz[i], cutoff, candidates);
+            for (int j : candidates)
+            {
+                double d2 = 0;
+                for (int d = 0; d < NDIM; ++d)
+                    d2 += (p_xyz[i][d] - p_xyz[j][d]) * (p_xyz[i][d] - p_xyz[j][d]);
+                if (j != i && d2 < cutoff * cutoff)
+                    adj[i].push_back(j);
+            }
+        }
+    }
+
+    // every connected component is started from a pseudo-peripheral particle (George-Liu algorithm), which
+    // is searched from the unvisited particle of lowest degree
+    std::vector<int> start(n);
+    std::iota(start.begin(), start.end(), 0);
+    std::stable_sort(start.begin(), start.end(), [&adj](int a, int b)
+                     { return adj[a].size() < adj[b].size(); });
+
+    std::vector<int> order, level(n, -1);
+    order.reserve(n);
+    std::vector<bool> visited(n, false);
+    for (int s : start)
+    {
+        if (visited[s])
+            continue;
+
+        std::vector<int> comp = levelStructure(adj, s, level);
+        while (true)
+        {
+            // lowest degree particle of the last level, it becomes the root if its level structure is deeper
+            int depth = level[comp.back()], root = comp.back();
+            for (int k = (int)comp.size() - 1; k >= 0 && level[comp[k]] == depth; --k)
+            {
+                if (adj[comp[k]].size() < adj[root].size())
+                    root = comp[k];
+            }
+
+            for (int j : comp)
+                level[j] = -1;
+            std::vector<int> trial = levelStructure(adj, root, level);
+            if (level[trial.back()] <= depth)
+            {
+                for (int j : trial)
+                    level[j] = -1;
+                break;
+            }
+            s = root, comp = trial;
+        }
+
+        // Cuthill-McKee numbering of the component, neighbors are visited by increasing degree
+        visited[s] = true;
+        order.push_back(s);
+        for (int head = (int)order.size() - 1; head < (int)order.size(); ++head) // breadth-first, order is the queue
+        {
+            std::vector<int> next;
+            for (int j : adj[order[head]])
+            {
+                if (!visited[j])
+                {
+                    visited[j] = true;
+                    next.push_back(j);
+                }
+            }
+            std::stable_sort(next.begin(), next.end(), [&adj](int a, int b)
+                             { return adj[a].size() < adj[b].size(); });
+            order.insert(order.end(), next.begin(), next.end());
+        }
+    }
+
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+std::vector<int> particleOrder(const ReorderMode &p_reorder, const std::vector<std::array<double, NDIM>> &p_xyz, double cutoff)
+{
+    if (p_reorder == ReorderMode::Morton)
+        return mortonOrder(p_xyz);
+    if (p_reorder == ReorderMode::RCM)
+        return rcmOrder(p_xyz, cutoff);
+
+    std::vector<int> order(p_xyz.size());
+    std::iota(order.begin(), order.end(), 0);
+    return order;
+}
+
+#endif
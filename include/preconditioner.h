@@ -0,0 +1,251 @@
+#pragma once
+#ifndef PRECONDITIONER_H
+#define PRECONDITIONER_H
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+#include "lpm.h"
+#include "amg.h"
+#include "gmg.h"
+
+// Preconditioners of the CG solver, for the symmetric system in one-based upper triangle CSR (the diagonal entry is
+// the first one of each row), built once for the values of an assembly and applied in the RCI loop
+
+class Preconditioner
+{
+    std::vector<double> values;    // inverse diagonal, inverse diagonal blocks (NDIM * NDIM each), or the IC(0) factor U
+    std::vector<MKL_INT> blocks;   // first DOF of each diagonal block, block-Jacobi
+    const MKL_INT *IK{nullptr}, *JK{nullptr};
+    MKL_INT n{0};
+    PreconditionerMode applied{PreconditionerMode::None}; // differs from built_mode if IC(0) fell back to Jacobi
+
+    void buildJacobi(const double *K);
+    void buildBlockJacobi(const double *K);
+    void buildIC0(const double *K);
+
+public:
+    PreconditionerMode mode{PreconditionerMode::None};
+    int values_version{-1}, system_version{-1}, bc_version{-1}; // versions of the system it was built for, -1 means not built
+    AMG amg;
+    GMG gmg;
+    PreconditionerMode built_mode{PreconditionerMode::None};    // mode it was built for
+
+    // p_blocks holds the first DOF of each particle block and n at the end (only used by block-Jacobi)
+    void build(MKL_INT p_n, const MKL_INT *p_IK, const MKL_INT *p_JK, const double *K, const std::vector<MKL_INT> &p_blocks);
+    // the hierarchy is only set up again for a new topology, otherwise the first level takes the new values
+    void buildAMG(MKL_INT p_n, const MKL_INT *p_IK, const MKL_INT *p_JK, const double *K, const std::vector<MKL_INT> &p_blocks,
+                  const std::vector<MKL_INT> &g_ptr, const std::vector<MKL_INT> &g_adj, const std::vector<double> &B, int nB, bool new_topology);
+    // the transfer operators are only set up again for a new topology, the coarse operators follow the new values
+    void buildGMG(MKL_INT p_n, const MKL_INT *p_IK, const MKL_INT *p_JK, const double *K, const std::vector<MKL_INT> &p_blocks,
+                  const std::vector<std::vector<std::array<double, NDIM>>> &xyz, const std::vector<double> &radius, const std::vector<MKL_INT> &dofs,
+                  int dim, const std::array<double, NDIM * NDIM> &R, bool new_topology);
+    void apply(const double *r, double *z); // z = C^-1 r
+};
+
+void Preconditioner::build(MKL_INT p_n, const MKL_INT *p_IK, const MKL_INT *p_JK, const double *K, const std::vector<MKL_INT> &p_blocks)
+{
+    n = p_n, IK = p_IK, JK = p_JK;
+    built_mode = mode, applied = mode;
+    if (mode == PreconditionerMode::Jacobi)
+        buildJacobi(K);
+    else if (mode == PreconditionerMode::BlockJacobi)
+    {
+        blocks = p_blocks;
+        buildBlockJacobi(K);
+    }
+    else if (mode == PreconditionerMode::IC0)
+        buildIC0(K);
+}
+
+void Preconditioner::buildAMG(MKL_INT p_n, const MKL_INT *p_IK, const MKL_INT *p_JK, const double *K, const std::vector<MKL_INT> &p_blocks,
+                              const std::vector<MKL_INT> &g_ptr, const std::vector<MKL_INT> &g_adj, const std::vector<double> &B, int nB, bool new_topology)
+{
+    n = p_n, IK = p_IK, JK = p_JK;
+    if (new_topology || built_mode != PreconditionerMode::AMG)
+        amg.setup(n, IK, JK, K, p_blocks, g_ptr, g_adj, B, nB);
+    else
+        amg.updateFine(K);
+    built_mode = PreconditionerMode::AMG, applied = PreconditionerMode::AMG;
+}
+
+void Preconditioner::buildGMG(MKL_INT p_n, const MKL_INT *p_IK, const MKL_INT *p_JK, const double *K, const std::vector<MKL_INT> &p_blocks,
+                              const std::vector<std::vector<std::array<double, NDIM>>> &xyz, const std::vector<double> &radius, const std::vector<MKL_INT> &dofs,
+                              int dim, const std::array<double, NDIM * NDIM> &R, bool new_topology)
+{
+    n = p_n, IK = p_IK, JK = p_JK;
+    if (new_topology || built_mode != PreconditionerMode::GMG)
+        gmg.setup(n, IK, JK, K, p_blocks, xyz, radius, dofs, dim, R);
+    else
+        gmg.updateFine(K);
+    built_mode = PreconditionerMode::GMG, applied = PreconditionerMode::GMG;
+}
+
+void Preconditioner::buildJacobi(const double *K)
+{
+    values.resize(n);
+#pragma omp parallel for
+    for (MKL_INT r = 0; r < n; ++r)
+    {
+        double d = K[IK[r] - 1];
+        values[r] = (d > 0) ? 1.0 / d : 1.0;
+    }
+}
+
+void Preconditioner::buildBlockJacobi(const double *K)
+{
+    // the DOFs of a particle are consecutive, its diagonal block is read from the upper triangle and inverted by
+    // Gauss-Jordan elimination (the blocks are symmetric positive definite, no pivoting)
+    int nblock = (int)blocks.size() - 1;
+    values.assign(nblock * NDIM * NDIM, 0.0);
+#pragma omp parallel for
+    for (int b = 0; b < nblock; ++b)
+    {
+        int m = (int)(blocks[b + 1] - blocks[b]);
+        std::array<std::array<double, 2 * NDIM>, NDIM> a{};
+        for (int i = 0; i < m; ++i)
+        {
+            MKL_INT r = blocks[b] + i;
+            for (MKL_INT e = IK[r] - 1; e < IK[r + 1] - 1 && JK[e] - 1 < blocks[b + 1]; ++e)
+            {
+                int j = (int)(JK[e] - 1 - blocks[b]);
+                a[i][j] = K[e], a[j][i] = K[e];
+            }
+            a[i][m + i] = 1.0;
+        }
+
+        bool singular{false};
+        for (int p = 0; p < m; ++p)
+        {
+            singular = !(a[p][p] > 0);
+            if (singular)
+                break;
+            double inv = 1.0 / a[p][p];
+            for (int j = 0; j < 2 * m; ++j)
+                a[p][j] *= inv;
+            for (int i = 0; i < m; ++i)
+            {
+                if (i == p)
+                    continue;
+                double f = a[i][p];
+                for (int j = 0; j < 2 * m; ++j)
+                    a[i][j] -= f * a[p][j];
+            }
+        }
+
+        double *inv_b = &values[b * NDIM * NDIM];
+        for (int i = 0; i < m; ++i)
+        {
+            for (int j = 0; j < m; ++j)
+                inv_b[i * NDIM + j] = singular ? (i == j) / std::max(K[IK[blocks[b] + i] - 1], 1e-300) : a[i][m + j];
+        }
+    }
+}
+
+void Preconditioner::buildIC0(const double *K)
+{
+    // K ~ U^T U with U in the pattern of K, row by row (right-looking), with a diagonal shift when a pivot breaks down
+    std::vector<MKL_INT> pos(n, -1); // position of a column in the row being updated
+    double shift{0.0};
+    for (int attempt = 0; attempt < 10; ++attempt)
+    {
+        values.assign(K, K + IK[n] - 1);
+        for (MKL_INT r = 0; r < n; ++r)
+            values[IK[r] - 1] *= 1.0 + shift;
+
+        bool breakdown{false};
+        for (MKL_INT k = 0; k < n; ++k)
+        {
+            MKL_INT e0 = IK[k] - 1, e1 = IK[k + 1] - 1;
+            breakdown = !(values[e0] > 0);
+            if (breakdown)
+                break;
+            values[e0] = std::sqrt(values[e0]);
+            for (MKL_INT e = e0 + 1; e < e1; ++e)
+                values[e] /= values[e0];
+
+            // U_jl -= U_kj U_kl for the columns j <= l of row k that are in the pattern of row j
+            for (MKL_INT ej = e0 + 1; ej < e1; ++ej)
+            {
+                MKL_INT j = JK[ej] - 1;
+                for (MKL_INT e = IK[j] - 1; e < IK[j + 1] - 1; ++e)
+                    pos[JK[e] - 1] = e;
+                for (MKL_INT el = ej; el < e1; ++el)
+                {
+                    MKL_INT p = pos[JK[el] - 1];
+                    if (p >= 0)
+                        values[p] -= values[ej] * values[el];
+                }
+                for (MKL_INT e = IK[j] - 1; e < IK[j + 1] - 1; ++e)
+                    pos[JK[e] - 1] = -1;
+            }
+        }
+        if (!breakdown)
+            return;
+
+        shift = (shift == 0.0) ? 1e-3 : 4 * shift;
+        printf("    IC(0) breakdown, diagonal shift %.1e\n", shift);
+    }
+    printf("    IC(0) failed, Jacobi is used instead\n");
+    applied = PreconditionerMode::Jacobi;
+    buildJacobi(K);
+}
+
+void Preconditioner::apply(const double *r, double *z)
+{
+    if (applied == PreconditionerMode::AMG)
+        amg.apply(r, z);
+    else if (applied == PreconditionerMode::GMG)
+        gmg.apply(r, z);
+    else if (applied == PreconditionerMode::Jacobi)
+    {
+#pragma omp parallel for
+        for (MKL_INT i = 0; i < n; ++i)
+            z[i] = values[i] * r[i];
+    }
+    else if (applied == PreconditionerMode::BlockJacobi)
+    {
+        int nblock = (int)blocks.size() - 1;
+#pragma omp parallel for
+        for (int b = 0; b < nblock; ++b)
+        {
+            int m = (int)(blocks[b + 1] - blocks[b]);
+            const double *inv_b = &values[b * NDIM * NDIM];
+            for (int i = 0; i < m; ++i)
+            {
+                double s{0};
+                for (int j = 0; j < m; ++j)
+                    s += inv_b[i * NDIM + j] * r[blocks[b] + j];
+                z[blocks[b] + i] = s;
+            }
+        }
+    }
+    else if (applied == PreconditionerMode::IC0)
+    {
+        // U^T y = r by columns of U^T (rows of U), then U z = y
+        for (MKL_INT i = 0; i < n; ++i)
+            z[i] = r[i];
+        for (MKL_INT k = 0; k < n; ++k)
+        {
+            z[k] /= values[IK[k] - 1];
+            for (MKL_INT e = IK[k]; e < IK[k + 1] - 1; ++e)
+                z[JK[e] - 1] -= values[e] * z[k];
+        }
+        for (MKL_INT k = n - 1; k >= 0; --k)
+        {
+            double s = z[k];
+            for (MKL_INT e = IK[k]; e < IK[k + 1] - 1; ++e)
+                s -= values[e] * z[JK[e] - 1];
+            z[k] = s / values[IK[k] - 1];
+        }
+    }
+    else
+    {
+        for (MKL_INT i = 0; i < n; ++i)
+            z[i] = r[i];
+    }
+}
+
+#endif
@@ -12,7 +12,7 @@ class Solution
 {
 public:
     ExactSolution exact_sol_mode;
-    Assembly<nlayer> ass;
+    Assembly<nlayer> &ass; // the particle system is shared with the caller, not copied
     std::vector<std::array<double, NDIM>> position;
     std::vector<double> exact_u, approx_u, error;
 
@@ -12,6 +12,8 @@
 #include "stiffness.h"
 #include "unit_cell.h"
 #include "assembly.h"
+#include "utilities.h"
+#include "preconditioner.h"
 
 template <int nlayer>
 class Solver
@@ -26,13 +28,51 @@ public:
     SolverMode sol_mode;
 
     Stiffness<nlayer> stiffness;
-    Assembly<nlayer> ass;
+    Assembly<nlayer> &ass; // the particle system is shared with the caller, not copied
+
+    sparse_matrix_t csrA;  // MKL handle of the system matrix, it references the arrays of the stiffness and is kept as long as the pattern is
+    int csr_version{-1};   // system version of csrA, -1 means not created
+    std::vector<double> disp_free; // solution of the reduced system
+
+    void *pardiso_pt[64];             // PARDISO handle, kept as long as the pattern of the system is
+    MKL_INT pardiso_iparm[64];        // parameters of the handle
+    MKL_INT pardiso_n{0};             // size of the system of the handle
+    int pardiso_version{-1};          // system version of the symbolic factorization, -1 means none
+    std::string perm_file;            // fill-in reducing permutation is read from or written to this file, empty for none
+    std::vector<MKL_INT> pardiso_perm;
+
+    Preconditioner precond; // of the CG solver, set precond.mode to use one
+    std::vector<std::vector<std::array<double, NDIM>>> coarse_xyz; // particles of the coarser lattices of the geometric multigrid, created on first use
+    std::vector<double> coarse_radius;                              // particle radius of each coarser lattice
+    double *lattice_R{nullptr};                                     // rotation the lattice was created with (createRMatrix), nullptr for none
+
+    NewtonMode newton_mode{NewtonMode::Full};
+    double stall_ratio{0.5};            // modified Newton refactors when an iteration reduces the residual less than this
+    bool refactor_pending{false};       // modified Newton, the next solve factorizes the current stiffness
+    int factor_values{-1}, factor_bc{-1}; // values and BC versions of the PARDISO factorization
+    int n_factor{0}, n_factor_saved{0}; // factorizations done and skipped in the current load step
+
+    bool implicit_state{false}; // return mapping in every Newton iteration (static solver), see setImplicitState
+    int fgmres_restart{30};     // Krylov vectors of the FGMRES solve of the (not symmetric) consistent tangent before a restart
 
     void updateDisplacementBC(LoadStep<nlayer> &load_step);
     void updateForceBC(LoadStep<nlayer> &load_step);
     void updateRR(); // update residual force and reaction force
-    void LPM_PARDISO();
-    void LPM_CG();
+    void updateInternalForce();
+    void updateStiffness();
+    bool assemblyDeferred(); // modified Newton keeps its factorization, the stiffness is only assembled when it stalls
+    void setImplicitState(bool p_implicit);
+    void LPM_PARDISO(double *x); // solve the system of the stiffness into x
+    void factorPARDISO();
+    void substitutePARDISO(double *b, double *x); // back substitution with the current factorization
+    void LPM_CG(double *x);
+    void buildPreconditioner(); // of the CG solver, for the values of the current assembly
+    void LPM_FGMRES(double *x); // consistent tangent, preconditioned by the solver of the symmetrized stiffness
+    void releasePARDISO();
+    void createCoarseLattices();
+    void printFactorizations();
+    bool readPermutation(MKL_INT n, MKL_INT nnz);
+    void writePermutation(MKL_INT n, MKL_INT nnz);
 
     void solveLinearSystem();
     int NewtonIteration(); // return number of Newton iterations
@@ -48,15 +88,76 @@ public:
     ~Solver()
     {
         delete[] disp;
+        releasePARDISO();
+        if (csr_version >= 0)
+            mkl_sparse_destroy(csrA);
     }
 };
 
+template <int nlayer>
+void Solver<nlayer>::setImplicitState(bool p_implicit)
+{
+    // the state variables are updated from the last converged ones at every Newton iterate instead of after convergence,
+    // and the stiffness gets the matching (consistent) plastic tangent of the return mapping, whose pattern is wider;
+    // every Newton iteration assembles the tangent of its iterate, which is solved by FGMRES, so in modified Newton the
+    // kept factorization only preconditions it
+    implicit_state = p_implicit;
+    stiffness.consistent_tangent = p_implicit;
+    if (ass.wide_conns == p_implicit)
+        return;
+
+    ass.wide_conns = p_implicit;
+    ass.updateConnections();
+    stiffness.initialize(ass.pt_sys);
+}
+
+template <int nlayer>
+void Solver<nlayer>::updateInternalForce()
+{
+    if (implicit_state)
+    {
+        // trial forces from the last converged state and the return mapping, the forces below use the new plastic stretch
+        ass.resetStateVar(false);
+        ass.updateGeometryForceState();
+        ass.updateStateVar();
+    }
+    ass.updateGeometryForceState();
+}
+
+template <int nlayer>
+void Solver<nlayer>::updateStiffness()
+{
+    // full assembly unless only the blocks around the changed bonds have to be updated
+    if (!stiffness.incremental || !stiffness.calcStiffnessIncremental(ass.pt_sys))
+    {
+        stiffness.reset(ass.pt_sys);
+        if (ass.pt_sys[0]->cell.dim == 2)
+            stiffness.calcStiffness2D(ass.pt_sys);
+        else
+            stiffness.calcStiffness3D(ass.pt_sys);
+        if (stiffness.incremental)
+            stiffness.storeAssembled(ass.pt_sys, true);
+    }
+    stiffness.updateStiffnessDispBC(ass.pt_sys);
+}
+
+template <int nlayer>
+bool Solver<nlayer>::assemblyDeferred()
+{
+    // the values of a new assembly would not be factorized before modified Newton stalls (see NewtonIteration), as long
+    // as the factorization holds the current pattern and constrained DOFs
+    if (newton_mode != NewtonMode::Modified || sol_mode != SolverMode::PARDISO || refactor_pending || factor_values < 0 ||
+        pardiso_version != stiffness.system_version)
+        return false;
+    stiffness.updateEliminated(ass.pt_sys);
+    return factor_bc == stiffness.bc_version;
+}
+
 template <int nlayer>
 int Solver<nlayer>::NewtonIteration()
 {
     // update the force state and residual
-    ass.updateGeometry();
-    ass.updateForceState();
+    updateInternalForce();
     updateRR();
 
     // compute the Euclidean norm (L2 norm)
@@ -77,13 +178,24 @@ int Solver<nlayer>::NewtonIteration()
             return max_NR_iter; // abnormal return
 
         printf("|  |  Iteration-%d: ", ni);
+        if (implicit_state && ni > 1)
+            updateStiffness(); // tangent of the current return mapping, the first iteration uses the one of the load step
         solveLinearSystem(); // solve for the incremental displacement
 
-        ass.updateGeometry();
-        ass.updateForceState();
+        updateInternalForce();
         updateRR(); /* update the RHS risidual force vector */
+        double norm_last = norm_residual;
         norm_residual = cblas_dnrm2(problem_size, stiffness.residual, 1);
         printf("|  |  Norm of residual is %.3e, residual ratio is %.3e\n", norm_residual, norm_residual / tol_multiplier);
+
+        if (newton_mode == NewtonMode::Modified && sol_mode == SolverMode::PARDISO && norm_residual > stall_ratio * norm_last)
+        {
+            // stalled with an old factorization, or with the stiffness of the load step (the implicit state assembles
+            // the one of this iterate at the start of the next iteration)
+            if (factor_values == stiffness.values_version && !refactor_pending && !implicit_state)
+                updateStiffness();
+            refactor_pending = true;
+        }
     }
 
     return ni; // normal return, return number of iterations
@@ -92,12 +204,30 @@ int Solver<nlayer>::NewtonIteration()
 template <int nlayer>
 void Solver<nlayer>::solveLinearSystem()
 {
-    if (sol_mode == SolverMode::PARDISO)
-        LPM_PARDISO();
-    else
-        LPM_CG();
+    // the reduced system only holds the free DOFs, its solution is scattered back to all DOFs
+    double *x = disp;
+    if (stiffness.reduced_system)
+    {
+        stiffness.gatherResidual();
+        disp_free.resize(stiffness.n_free);
+        x = disp_free.data();
+    }
+
+    if (stiffness.systemSize() > 0)
+    {
+        if (stiffness.consistent_tangent)
+            LPM_FGMRES(x);
+        else if (sol_mode == SolverMode::PARDISO)
+            LPM_PARDISO(x);
+        else
+            LPM_CG(x);
+    }
+
+    if (stiffness.reduced_system)
+        stiffness.scatterSolution(x, disp);
 
     /* update the position */
+#pragma omp parallel for
     for (auto pt : ass.pt_sys)
     {
         std::array<double, NDIM> dxyz{0, 0, 0};
@@ -111,14 +241,19 @@ void Solver<nlayer>::solveLinearSystem()
 template <int nlayer>
 void Solver<nlayer>::updateRR()
 {
+    /* residual force (exclude the DoF that being applied to displacement BC) */
+#pragma omp parallel for
     for (Particle<nlayer> *pt : ass.pt_sys)
     {
         for (int k = 0; k < pt->cell.dim; k++)
-        {
-            /* residual force (exclude the DoF that being applied to displacement BC) */
             stiffness.residual[(pt->cell.dim) * (pt->id) + k] = (1 - pt->disp_constraint[k]) * (pt->Pex[k] - pt->Pin[k]);
+    }
 
-            /* reaction force (DoF being applied to displacement BC) */
+    /* reaction force (DoF being applied to displacement BC), appended in particle order */
+    for (Particle<nlayer> *pt : ass.pt_sys)
+    {
+        for (int k = 0; k < pt->cell.dim; k++)
+        {
             if (pt->disp_constraint[k] == 1)
                 reaction_force.push_back(pt->Pin[k]);
         }
@@ -128,8 +263,10 @@ void Solver<nlayer>::updateRR()
 template <int nlayer>
 void Solver<nlayer>::updateDisplacementBC(LoadStep<nlayer> &load_step)
 {
-    for (DispBC<nlayer> bc : load_step.dispBCs)
+    // a particle can be in several BCs, so only the particles of one BC are updated in parallel
+    for (const DispBC<nlayer> &bc : load_step.dispBCs)
     {
+#pragma omp parallel for
         for (Particle<nlayer> *pt : bc.group)
         {
             if (bc.flag == 'x')
@@ -166,9 +303,10 @@ void Solver<nlayer>::updateDisplacementBC(LoadStep<nlayer> &load_step)
 template <int nlayer>
 void Solver<nlayer>::updateForceBC(LoadStep<nlayer> &load_step)
 {
-    for (ForceBC<nlayer> bc : load_step.forceBCs)
+    for (const ForceBC<nlayer> &bc : load_step.forceBCs)
     {
         int num_forceBC = (int)bc.group.size();
+#pragma omp parallel for
         for (Particle<nlayer> *pt : bc.group)
         {
             if (bc.load_mode == LoadMode::Relative)
@@ -188,93 +326,241 @@ void Solver<nlayer>::updateForceBC(LoadStep<nlayer> &load_step)
 }
 
 template <int nlayer>
-void Solver<nlayer>::LPM_PARDISO()
+void Solver<nlayer>::LPM_PARDISO(double *x)
+{
+    MKL_INT iter = 1; /* Iteration number */
+    factorPARDISO();
+    substitutePARDISO(stiffness.systemRHS(), x);
+    printf("    Solve completed at iteration: " IFORMAT "\n", iter);
+}
+
+template <int nlayer>
+void Solver<nlayer>::factorPARDISO()
 {
-    MKL_INT n, idum, maxfct, mnum, mtype, phase, error, error1, msglvl, nrhs, iter;
-    MKL_INT iparm[64];
+    // the handle is kept between the calls, so the reordering and symbolic factorization (phase 11) only run again
+    // when the pattern of the system changes, while the numerical factorization follows the values of every call
+    MKL_INT n, idum, maxfct, mnum, mtype, phase, error, msglvl, nrhs;
     double ddum;
 
-    void *pt[64]; /* Internal solver memory pointer */
-
-    for (int i = 0; i < 64; i++)
-        iparm[i] = 0;
-    iparm[0] = 1;  /* No solver default */
-    iparm[1] = 3;  /* The parallel (OpenMP) version of the nested dissection algorithm is used */
-    iparm[3] = 0;  /* No iterative-direct algorithm */
-    iparm[4] = 0;  /* No user fill-in reducing permutation */
-    iparm[5] = 0;  /* Write solution into x */
-    iparm[6] = 0;  /* Not in use */
-    iparm[7] = 0;  /* Max numbers of iterative refinement steps */
-    iparm[8] = 0;  /* Not in use */
-    iparm[9] = 13; /* Perturb the pivot elements with 1E-13 */
-    iparm[10] = 1; /* Use nonsymmetric permutation and scaling MPS */
-    // iparm[11] = 0;        /* Not in use */
-    iparm[12] = 1; /* Maximum weighted matching algorithm is switched-off (default for
-                          symmetric). Try iparm[12] = 1 in case of inappropriate accuracy */
-                   // iparm[13] = 0;        /* Output: Number of perturbed pivots */
-    // iparm[14] = 0;        /* Not in use */
-    // iparm[15] = 0;        /* Not in use */
-    // iparm[16] = 0;        /* Not in use */
-    // iparm[17] = -1;       /* Output: Number of nonzeros in the factor LU */
-    // iparm[18] = -1;       /* Output: Mflops for LU factorization */
-    // iparm[19] = 0;        /* Output: Numbers of CG Iterations */
-
-    n = problem_size; /* Data number */
-    maxfct = 1;       /* Maximum number of numerical factorizations */
-    mnum = 1;         /* Which factorization to use */
-    msglvl = 0;       /* 0, no print statistical info; 1, print statistical info */
-    error = 0;        /* Initialize error flag */
+    n = stiffness.systemSize(); /* Data number */
+    maxfct = 1;                 /* Maximum number of numerical factorizations */
+    mnum = 1;                   /* Which factorization to use */
+    msglvl = 0;                 /* 0, no print statistical info; 1, print statistical info */
+    error = 0;                  /* Initialize error flag */
 
     mtype = 2; /* Real symmetric positive definite, -2: real+symmetric+indefinite */
     nrhs = 1;  /* Number of right hand sides */
-    iter = 1;  /* Iteration number */
 
-    for (int i = 0; i < 64; i++)
-        pt[i] = 0; /* Initiliaze the internal solver memory pointer */
-
-    /* Reordering and Symbolic Factorization. This step also allocates all memory that is  */
-    /* necessary for the factorization */
-    phase = 11;
-    PARDISO(pt, &maxfct, &mnum, &mtype, &phase, &n, stiffness.K_global, stiffness.IK, stiffness.JK, &idum, &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
-    if (error != 0)
+    if (pardiso_version != stiffness.system_version)
     {
-        printf("\nERROR during symbolic factorization: " IFORMAT, error);
-        exit(1);
+        releasePARDISO();
+
+        for (int i = 0; i < 64; i++)
+            pardiso_iparm[i] = 0;
+        pardiso_iparm[0] = 1;  /* No solver default */
+        pardiso_iparm[1] = 3;  /* The parallel (OpenMP) version of the nested dissection algorithm is used */
+        pardiso_iparm[3] = 0;  /* No iterative-direct algorithm */
+        pardiso_iparm[4] = 0;  /* No user fill-in reducing permutation */
+        pardiso_iparm[5] = 0;  /* Write solution into x */
+        pardiso_iparm[6] = 0;  /* Not in use */
+        pardiso_iparm[7] = 0;  /* Max numbers of iterative refinement steps */
+        pardiso_iparm[8] = 0;  /* Not in use */
+        pardiso_iparm[9] = 13; /* Perturb the pivot elements with 1E-13 */
+        pardiso_iparm[10] = 1; /* Use nonsymmetric permutation and scaling MPS */
+        pardiso_iparm[12] = 1; /* Maximum weighted matching algorithm is switched-off (default for
+                                  symmetric). Try iparm[12] = 1 in case of inappropriate accuracy */
+
+        for (int i = 0; i < 64; i++)
+            pardiso_pt[i] = 0; /* Initiliaze the internal solver memory pointer */
+
+        /* the fill-in reducing permutation is read from perm_file if it was written for the same system, otherwise it is
+           returned by the reordering and written there */
+        MKL_INT *p_perm = nullptr;
+        if (!perm_file.empty())
+        {
+            pardiso_perm.assign(n, 0);
+            p_perm = pardiso_perm.data();
+            pardiso_iparm[4] = readPermutation(n, stiffness.systemIK()[n] - 1) ? 1 : 2;
+        }
+
+        /* Reordering and Symbolic Factorization. This step also allocates all memory that is  */
+        /* necessary for the factorization */
+        phase = 11;
+        PARDISO(pardiso_pt, &maxfct, &mnum, &mtype, &phase, &n, stiffness.systemK(), stiffness.systemIK(), stiffness.systemJK(), p_perm, &nrhs, pardiso_iparm, &msglvl, &ddum, &ddum, &error);
+        if (error != 0)
+        {
+            printf("\nERROR during symbolic factorization: " IFORMAT, error);
+            exit(1);
+        }
+        pardiso_version = stiffness.system_version;
+        pardiso_n = n;
+        factor_values = -1; /* the numerical factorization has to follow */
+        printf("    PARDISO: Size of factors(MB): %f\n", pardiso_iparm[16] / 1000.0);
+
+        if (pardiso_iparm[4] == 2)
+            writePermutation(n, stiffness.systemIK()[n] - 1);
+        pardiso_iparm[4] = 0; /* the permutation is only an input or output of phase 11 */
     }
-    // printf("PARDISO: Size of factors(MB): %f", MAX(iparm[14], iparm[15] + iparm[16]) / 1000.0);
-    printf("    PARDISO: Size of factors(MB): %f", iparm[16] / 1000.0);
 
-    /* Numerical factorization */
-    phase = 22;
-    PARDISO(pt, &maxfct, &mnum, &mtype, &phase, &n, stiffness.K_global, stiffness.IK, stiffness.JK, &idum, &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
-    if (error != 0)
+    /* Numerical factorization, skipped for the same matrix, and in modified Newton until it is requested (the
+       constrained DOFs of the factorization have to be the current ones) */
+    bool new_values = (factor_values != stiffness.values_version);
+    if (newton_mode == NewtonMode::Modified)
+        new_values = new_values && refactor_pending;
+    if (factor_values < 0 || factor_bc != stiffness.bc_version || new_values)
     {
-        printf("\nERROR during numerical factorization: " IFORMAT, error);
-        exit(2);
+        phase = 22;
+        PARDISO(pardiso_pt, &maxfct, &mnum, &mtype, &phase, &n, stiffness.systemK(), stiffness.systemIK(), stiffness.systemJK(), &idum, &nrhs, pardiso_iparm, &msglvl, &ddum, &ddum, &error);
+        if (error != 0)
+        {
+            printf("\nERROR during numerical factorization: " IFORMAT, error);
+            exit(2);
+        }
+        factor_values = stiffness.values_version;
+        factor_bc = stiffness.bc_version;
+        refactor_pending = false;
+        ++n_factor;
     }
+    else
+        ++n_factor_saved;
+}
+
+template <int nlayer>
+void Solver<nlayer>::substitutePARDISO(double *b, double *x)
+{
+    MKL_INT idum, maxfct{1}, mnum{1}, mtype{2}, phase{33}, msglvl{0}, nrhs{1}, error{0};
 
     /* Back substitution and iterative refinement */
-    phase = 33;
-    PARDISO(pt, &maxfct, &mnum, &mtype, &phase, &n, stiffness.K_global, stiffness.IK, stiffness.JK, &idum, &nrhs, iparm, &msglvl, stiffness.residual, disp, &error);
+    PARDISO(pardiso_pt, &maxfct, &mnum, &mtype, &phase, &pardiso_n, stiffness.systemK(), stiffness.systemIK(), stiffness.systemJK(), &idum, &nrhs, pardiso_iparm, &msglvl, b, x, &error);
     if (error != 0)
     {
         printf("\nERROR during solution: " IFORMAT, error);
         exit(3);
     }
-    printf("\n    Solve completed at iteration: " IFORMAT "\n", iter);
+}
+
+template <int nlayer>
+void Solver<nlayer>::printFactorizations()
+{
+    if (sol_mode != SolverMode::PARDISO)
+        return;
+    printf("PARDISO numerical factorizations: %d, reused: %d\n", n_factor, n_factor_saved);
+    n_factor = 0, n_factor_saved = 0;
+}
 
+template <int nlayer>
+void Solver<nlayer>::releasePARDISO()
+{
+    if (pardiso_version < 0)
+        return;
+
+    MKL_INT idum, maxfct{1}, mnum{1}, mtype{2}, phase{-1}, msglvl{0}, nrhs{1}, error1{0};
+    double ddum;
     /* Termination and release of memory */
-    phase = -1; /* Release internal memory. */
-    PARDISO(pt, &maxfct, &mnum, &mtype, &phase, &n, &ddum, stiffness.IK, stiffness.JK, &idum, &nrhs, iparm, &msglvl, &ddum, &ddum, &error1);
+    PARDISO(pardiso_pt, &maxfct, &mnum, &mtype, &phase, &pardiso_n, &ddum, &idum, &idum, &idum, &nrhs, pardiso_iparm, &msglvl, &ddum, &ddum, &error1);
     if (error1 != 0)
     {
         printf("\nERROR on release stage: " IFORMAT, error1);
         exit(4);
     }
+    pardiso_version = -1;
+}
+
+template <int nlayer>
+void Solver<nlayer>::createCoarseLattices()
+{
+    // the lattice of the assembly on its box with the radius doubled at each level (simple cubic for the BCC ones),
+    // only the particles within one spacing of the finer lattice are kept (notches, holes), until it is small enough
+    // for the coarsest level of the multigrid; the coarse operators are Galerkin products, so only the positions are
+    // needed and no particles or bonds are created
+    UnitCell &cell = ass.pt_sys[0]->cell;
+    LatticeType lattice = (cell.dim == 3 && cell.lattice != LatticeType::FCC3D) ? LatticeType::SimpleCubic3D : cell.lattice;
+    double I[NDIM * NDIM]{1, 0, 0, 0, 1, 0, 0, 0, 1};
+    double *R = lattice_R ? lattice_R : I;
+
+    std::vector<std::array<double, NDIM>> xyz_f;
+    for (Particle<nlayer> *pt : ass.pt_sys)
+        xyz_f.push_back(pt->xyz_initial);
+    double radius = cell.radius;
+    while ((int)coarse_xyz.size() + 1 < precond.gmg.max_levels && cell.dim * (int)xyz_f.size() > precond.gmg.coarse_size)
+    {
+        radius *= 2;
+        UnitCell cell_c(lattice, radius);
+        std::vector<std::array<double, NDIM>> xyz_c;
+        if (lattice == LatticeType::Square2D)
+            xyz_c = createPlateSQ2D(ass.box, cell_c, R);
+        else if (lattice == LatticeType::Hexagon2D)
+            xyz_c = createPlateHEX2D(ass.box, cell_c, R);
+        else if (lattice == LatticeType::FCC3D)
+            xyz_c = createCuboidFCC3D(ass.box, cell_c, R);
+        else
+            xyz_c = createCuboidSC3D(ass.box, cell_c, R);
+
+        CellList cells(xyz_f, cell_c.neighbor_cutoff[0]);
+        std::vector<int> candidates;
+        std::vector<std::array<double, NDIM>> xyz_kept;
+        for (const std::array<double, NDIM> &x : xyz_c)
+        {
+            cells.findCandidates(x, cell_c.neighbor_cutoff[0], candidates);
+            for (int i : candidates)
+            {
+                double d2{0};
+                for (int k = 0; k < NDIM; ++k)
+                    d2 += (xyz_f[i][k] - x[k]) * (xyz_f[i][k] - x[k]);
+                if (d2 <= cell_c.neighbor_cutoff[0] * cell_c.neighbor_cutoff[0])
+                {
+                    xyz_kept.push_back(x);
+                    break;
+                }
+            }
+        }
+        if (xyz_kept.size() < 2 || xyz_kept.size() >= xyz_f.size())
+            break;
+
+        printf("Coarse lattice %zu, radius %f, %zu particles\n", coarse_xyz.size() + 1, radius, xyz_kept.size());
+        coarse_xyz.push_back(xyz_kept);
+        coarse_radius.push_back(radius);
+        xyz_f.swap(xyz_kept);
+    }
 }
 
 template <int nlayer>
-void Solver<nlayer>::LPM_CG()
+bool Solver<nlayer>::readPermutation(MKL_INT n, MKL_INT nnz)
+{
+    // the file starts with the size and the number of nonzeros of the system it was written for
+    FILE *fpt = fopen(perm_file.c_str(), "r");
+    if (fpt == NULL)
+        return false;
+
+    long long n_file{0}, nnz_file{0}, v{0};
+    bool valid = fscanf(fpt, "%lld %lld", &n_file, &nnz_file) == 2 && n_file == n && nnz_file == nnz;
+    for (MKL_INT i = 0; valid && i < n; ++i)
+    {
+        valid = fscanf(fpt, "%lld", &v) == 1 && v >= 1 && v <= n;
+        pardiso_perm[i] = (MKL_INT)v;
+    }
+    fclose(fpt);
+
+    if (valid)
+        printf("    PARDISO: fill-in reducing permutation read from %s\n", perm_file.c_str());
+    return valid;
+}
+
+template <int nlayer>
+void Solver<nlayer>::writePermutation(MKL_INT n, MKL_INT nnz)
+{
+    FILE *fpt = fopen(perm_file.c_str(), "w");
+    if (fpt == NULL)
+        return;
+
+    fprintf(fpt, "%lld %lld\n", (long long)n, (long long)nnz);
+    for (MKL_INT i = 0; i < n; ++i)
+        fprintf(fpt, "%lld\n", (long long)pardiso_perm[i]);
+    fclose(fpt);
+}
+
+template <int nlayer>
+void Solver<nlayer>::LPM_CG(double *x)
 {
     MKL_INT n, rci_request, itercount, mkl_disable_fast_mm;
     MKL_INT ipar[128];
@@ -282,7 +568,6 @@ void Solver<nlayer>::LPM_CG()
 
     /* matrix descriptor */
     struct matrix_descr descrA;
-    sparse_matrix_t csrA;
     sparse_operation_t transA = SPARSE_OPERATION_NON_TRANSPOSE;
     descrA.type = SPARSE_MATRIX_TYPE_SYMMETRIC;
     descrA.mode = SPARSE_FILL_MODE_UPPER;
@@ -290,37 +575,46 @@ void Solver<nlayer>::LPM_CG()
     mkl_disable_fast_mm = 1; /* avoid memory leaks */
 
     /* initial setting */
-    n = problem_size; /* Data number */
+    n = stiffness.systemSize(); /* Data number */
     tmp = new double[4 * n]{};
 
-    mkl_sparse_d_create_csr(&csrA, SPARSE_INDEX_BASE_ONE, n, n, stiffness.IK, stiffness.IK + 1, stiffness.JK, stiffness.K_global);
+    /* the handle only has to be created again when the sparsity pattern changes, the values are read from K_global */
+    if (csr_version != stiffness.system_version)
+    {
+        if (csr_version >= 0)
+            mkl_sparse_destroy(csrA);
+        mkl_sparse_d_create_csr(&csrA, SPARSE_INDEX_BASE_ONE, n, n, stiffness.systemIK(), stiffness.systemIK() + 1, stiffness.systemJK(), stiffness.systemK());
+        csr_version = stiffness.system_version;
+    }
 
     /* initial guess for the displacement vector */
     for (int i = 0; i < n; i++)
-        disp[i] = 0;
+        x[i] = 0;
 
     /* initialize the solver */
-    dcg_init(&n, disp, stiffness.residual, &rci_request, ipar, dpar, tmp);
+    buildPreconditioner();
+
+    dcg_init(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp);
     if (rci_request != 0)
         goto failure;
 
     /* modify the initialized solver parameters */
-    ipar[4] = problem_size;
+    ipar[4] = n;
     ipar[8] = 1; /* default value is 0, does not perform the residual stopping test; otherwise, perform the test */
     ipar[9] = 0; /* default value is 1, perform user defined stopping test; otherwise, does not perform the test */
-    // ipar[10] = 1;    /* use the preconditioned version of the CG method */
+    ipar[10] = (precond.mode != PreconditionerMode::None); /* use the preconditioned version of the CG method */
     dpar[0] = 1e-12; /* specifies the relative tolerance, the default value is 1e-6 */
     dpar[1] = 1e-12; /* specifies the absolute tolerance, the default value is 0.0 */
 
     /* check the correctness and consistency of the newly set parameters */
-    dcg_check(&n, disp, stiffness.residual, &rci_request, ipar, dpar, tmp);
+    dcg_check(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp);
     if (rci_request != 0)
         goto failure;
 
     /* compute the solution by RCI (residual)CG solver */
     /* reverse Communications starts here */
 rci:
-    dcg(&n, disp, stiffness.residual, &rci_request, ipar, dpar, tmp);
+    dcg(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp);
     /* if rci_request=0, then the solution was found according to the requested  */
     /* stopping tests. in this case, this means that it was found after 100      */
     /* iterations. */
@@ -335,13 +629,20 @@ rci:
         goto rci;
     }
 
+    /* If rci_request=3, then apply the preconditioner to TMP[2n] and put the result in TMP[3n] */
+    if (rci_request == 3)
+    {
+        precond.apply(&tmp[2 * n], &tmp[3 * n]);
+        goto rci;
+    }
+
     /* If rci_request=anything else, then dcg subroutine failed                  */
     /* to compute the solution vector: solution[n]                               */
     goto failure;
     /* Reverse Communication ends here                                           */
     /* Get the current iteration number into itercount                           */
 getsln:
-    dcg_get(&n, disp, stiffness.residual, &rci_request, ipar, dpar, tmp, &itercount);
+    dcg_get(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp, &itercount);
     printf("    The system has been solved after " IFORMAT " iterations\n", itercount);
     goto success;
 
@@ -353,4 +654,146 @@ success:
     delete[] tmp;
 }
 
+template <int nlayer>
+void Solver<nlayer>::buildPreconditioner()
+{
+    // the preconditioner is built once for the values of an assembly
+    MKL_INT n = stiffness.systemSize();
+    if (precond.mode != PreconditionerMode::None &&
+        (precond.values_version != stiffness.values_version || precond.system_version != stiffness.system_version || precond.built_mode != precond.mode))
+    {
+        double t1 = omp_get_wtime();
+        std::vector<MKL_INT> blocks = stiffness.systemBlocks(ass.pt_sys[0]->cell.dim);
+        if (precond.mode == PreconditionerMode::AMG)
+        {
+            bool new_topology = (precond.system_version != stiffness.system_version || precond.bc_version != stiffness.bc_version);
+            std::vector<MKL_INT> g_ptr, g_adj;
+            std::vector<double> B;
+            int nB{0};
+            if (new_topology)
+            {
+                stiffness.systemGraph(ass.pt_sys, g_ptr, g_adj);
+                B = stiffness.systemRigidModes(ass.pt_sys, nB);
+            }
+            precond.buildAMG(n, stiffness.systemIK(), stiffness.systemJK(), stiffness.systemK(), blocks, g_ptr, g_adj, B, nB, new_topology);
+        }
+        else if (precond.mode == PreconditionerMode::GMG)
+        {
+            bool new_topology = (precond.system_version != stiffness.system_version || precond.bc_version != stiffness.bc_version);
+            int dim = ass.pt_sys[0]->cell.dim;
+            std::vector<std::vector<std::array<double, NDIM>>> xyz;
+            std::vector<MKL_INT> dofs;
+            std::array<double, NDIM * NDIM> R{1, 0, 0, 0, 1, 0, 0, 0, 1};
+            if (lattice_R)
+                std::copy(lattice_R, lattice_R + NDIM * NDIM, R.begin());
+            if (new_topology)
+            {
+                if (coarse_xyz.empty())
+                    createCoarseLattices();
+                xyz.emplace_back();
+                for (Particle<nlayer> *pt : ass.pt_sys)
+                    xyz.back().push_back(pt->xyz_initial);
+                xyz.insert(xyz.end(), coarse_xyz.begin(), coarse_xyz.end());
+                dofs = stiffness.systemDofs();
+            }
+            precond.buildGMG(n, stiffness.systemIK(), stiffness.systemJK(), stiffness.systemK(), blocks, xyz, coarse_radius, dofs, dim, R, new_topology);
+        }
+        else
+            precond.build(n, stiffness.systemIK(), stiffness.systemJK(), stiffness.systemK(), blocks);
+        precond.values_version = stiffness.values_version;
+        precond.system_version = stiffness.system_version;
+        precond.bc_version = stiffness.bc_version;
+        printf("    Preconditioner is built in %f seconds\n", omp_get_wtime() - t1);
+    }
+}
+
+template <int nlayer>
+void Solver<nlayer>::LPM_FGMRES(double *x)
+{
+    // the consistent tangent is not symmetric, so the assembled (symmetrized) stiffness only right-preconditions the
+    // solve, by its PARDISO factorization or by the preconditioner of the CG solver, while the products take the blocks
+    // before the symmetrization; FGMRES allows the preconditioner of modified Newton to be an old factorization
+    MKL_INT n, rci_request, itercount, restart;
+    MKL_INT ipar[128];
+    double dpar[128], *tmp;
+
+    /* initial setting */
+    n = stiffness.systemSize(); /* Data number */
+    restart = std::min<MKL_INT>(fgmres_restart, n);
+    tmp = new double[(2 * restart + 1) * n + restart * (restart + 9) / 2 + 1]{};
+
+    /* initial guess for the displacement vector */
+    for (int i = 0; i < n; i++)
+        x[i] = 0;
+
+    /* initialize the solver */
+    if (sol_mode == SolverMode::PARDISO)
+        factorPARDISO();
+    else
+        buildPreconditioner();
+
+    dfgmres_init(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp);
+    if (rci_request != 0)
+        goto failure;
+
+    /* modify the initialized solver parameters */
+    ipar[4] = n;        /* maximum number of iterations */
+    ipar[7] = 1;        /* stop at the maximum number of iterations */
+    ipar[8] = 1;        /* perform the residual stopping test */
+    ipar[9] = 0;        /* does not perform the user defined stopping test */
+    ipar[10] = (sol_mode == SolverMode::PARDISO || precond.mode != PreconditionerMode::None); /* use the preconditioned version of the FGMRES method */
+    ipar[11] = 1;       /* automatic test for a zero norm of the next generated vector */
+    ipar[14] = restart; /* number of the non-restarted FGMRES iterations */
+    dpar[0] = 1e-6;     /* specifies the relative tolerance, the norms are not squared as in the CG solver */
+    dpar[1] = 1e-6;     /* specifies the absolute tolerance, the default value is 0.0 */
+
+    /* check the correctness and consistency of the newly set parameters */
+    dfgmres_check(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp);
+    if (rci_request != 0)
+        goto failure;
+
+    /* compute the solution by RCI FGMRES solver */
+    /* reverse Communications starts here */
+rci:
+    dfgmres(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp);
+    /* if rci_request=0, then the solution was found according to the requested stopping tests, -1 means that the  */
+    /* maximum number of iterations was reached, its last iterate is taken as well                                  */
+    if (rci_request == 0 || rci_request == -1)
+        goto getsln;
+
+    /* If rci_request=1, then compute the product of the tangent with TMP[ipar[21]-1] into TMP[ipar[22]-1] */
+    if (rci_request == 1)
+    {
+        stiffness.multiplyTangent(ass.pt_sys, &tmp[ipar[21] - 1], &tmp[ipar[22] - 1]);
+        goto rci;
+    }
+
+    /* If rci_request=3, then apply the preconditioner to TMP[ipar[21]-1] and put the result in TMP[ipar[22]-1] */
+    if (rci_request == 3)
+    {
+        if (sol_mode == SolverMode::PARDISO)
+            substitutePARDISO(&tmp[ipar[21] - 1], &tmp[ipar[22] - 1]);
+        else
+            precond.apply(&tmp[ipar[21] - 1], &tmp[ipar[22] - 1]);
+        goto rci;
+    }
+
+    /* If rci_request=anything else, then dfgmres subroutine failed */
+    goto failure;
+    /* Reverse Communication ends here */
+getsln:
+    if (rci_request == -1)
+        printf("    FGMRES reached the maximum number of iterations, relative residual %.3e\n", dpar[4] / dpar[2]);
+    dfgmres_get(&n, x, stiffness.systemRHS(), &rci_request, ipar, dpar, tmp, &itercount);
+    printf("    The consistent tangent has been solved after " IFORMAT " FGMRES iterations\n", itercount);
+    goto success;
+
+failure:
+    printf("    The computation FAILED as the solver has returned the ERROR code " IFORMAT "\n", rci_request);
+
+success:
+    /* free memory */
+    delete[] tmp;
+}
+
 #endif
\ No newline at end of file
@@ -76,53 +76,11 @@ template <int nlayer>
 bool SolverFatigue<nlayer>::updateFatigueDamage(double dNdt)
 {
     // update nonlocal damage dot
-    for (Particle<nlayer> *p1 : this->ass.pt_sys)
-    {
-        // p1->Ddot_nonlocal = p1->Ddot_local;
-        if (p1->type != undamaged_pt_type)
-        {
-            double A = 0;
-            p1->Ddot_nonlocal = 0; // nonlocal damage dot
-
-            // compute nonlocal damage rate based on Gaussian
-            for (Particle<nlayer> *p2 : p1->neighbors_nonlocal)
-            {
-                if (p2->type != undamaged_pt_type)
-                {
-                    double dis = p1->distanceTo(p2);
-                    double V_m = p2->cell.particle_volume * p2->nb / p2->cell.nneighbors;
-                    p1->Ddot_nonlocal += p2->Ddot_local * func_phi(dis, p1->nonlocal_L) * V_m;
-                    A += func_phi(dis, p1->nonlocal_L) * V_m;
-                }
-            }
-
-            // compute nonlocal damage rate using connection averaging
-            // for (Particle<nlayer> *p2 : p1->conns)
-            // {
-            //     double V_m = p2->cell.particle_volume * p2->nb / p2->cell.nneighbors;
-            //     p1->Ddot_nonlocal += p2->Ddot_local * V_m;
-            //     A += V_m;
-            // }
-
-            // compute nonlocal damage rate using neighbor averaging
-            // for (Particle<nlayer> *p2 : p1->neighbors)
-            // {
-            //     double V_m = p2->cell.particle_volume * p2->nb / p2->cell.nneighbors;
-            //     p1->Ddot_nonlocal += p2->Ddot_local * V_m;
-            //     A += V_m;
-            // }
-            p1->Ddot_nonlocal /= A;
-        }
-    }
-
-    bool any_damaged{false};
-    for (Particle<nlayer> *pt : this->ass.pt_sys)
-    {
-        if (pt->type != undamaged_pt_type)
-            any_damaged = pt->updateParticleFatigueDamage(dNdt) || any_damaged; // update the fatigue damage
-    }
+    this->ass.updateNonlocalDamageRate(undamaged_pt_type);
 
-    return any_damaged;
+    int undamaged = undamaged_pt_type;
+    return this->ass.arena.forEachAny([undamaged, &dNdt](auto &pt)
+                                      { return pt.type != undamaged && pt.updateParticleFatigueDamage(dNdt); }); // update the fatigue damage
 }
 
 template <int nlayer>
@@ -235,9 +193,9 @@ void SolverFatigue<nlayer>::solveProblemOneCycle(std::vector<LoadStep<nlayer>> &
     }
 
     new_damaged = updateFatigueDamage(dNdt); // delta_t is 1, so dN = dNdt * 1
+    this->refactor_pending = this->refactor_pending || new_damaged;
     this->ass.storeStateVar();               // store converged state variables
-    this->ass.updateGeometry();
-    this->ass.updateForceState();
+    this->ass.updateGeometryForceState();
 }
 
 template <int nlayer>
@@ -282,18 +240,15 @@ bool SolverFatigue<nlayer>::solveProblemStep(LoadStep<nlayer> &load_step)
     this->updateDisplacementBC(load_step);
 
     // update the stiffness matrix using current state variables (bdamage)
-    this->stiffness.reset(this->ass.pt_sys);
     double t11 = omp_get_wtime();
-    if (this->ass.pt_sys[0]->cell.dim == 2)
-        this->stiffness.calcStiffness2D(this->ass.pt_sys);
-    else
-        this->stiffness.calcStiffness3D(this->ass.pt_sys);
-    this->stiffness.updateStiffnessDispBC(this->ass.pt_sys);
+    if (!this->assemblyDeferred())
+        this->updateStiffness();
     double t12 = omp_get_wtime();
     printf("Stiffness matrix calculation costs %f seconds\n", t12 - t11);
 
     // balance the system using current bond configuration and state variables
     int n_newton = this->NewtonIteration();
+    this->printFactorizations();
     if (n_newton < this->max_NR_iter)
         return true; // normal return
     else
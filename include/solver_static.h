@@ -31,34 +31,17 @@ public:
 template <int nlayer>
 bool SolverStatic<nlayer>::updateStaticDamage()
 {
+    // damage only evolves when the nonlocal neighbors have been searched
+    if (this->ass.nonlocal_ptr.empty())
+        return false;
+
     // update nonlocal damage dot
-    for (Particle<nlayer> *p1 : this->ass.pt_sys)
-    {
-        if (p1->type != undamaged_pt_type)
-        {
-            double A = 0;
-            p1->Ddot_nonlocal = 0; // nonlocal damage dot
-            for (Particle<nlayer> *p2 : p1->neighbors_nonlocal)
-            {
-                if (p2->type != undamaged_pt_type)
-                {
-                    double dis = p1->distanceTo(p2);
-                    double V_m = p2->cell.particle_volume * p2->nb / p2->cell.nneighbors;
-                    p1->Ddot_nonlocal += p2->Ddot_local * func_phi(dis, p1->nonlocal_L) * V_m;
-                    A += func_phi(dis, p1->nonlocal_L) * V_m;
-                }
-            }
-            p1->Ddot_nonlocal /= A;
-        }
-    }
+    this->ass.updateNonlocalDamageRate(undamaged_pt_type);
 
     // update local-wise damage
-    bool any_damaged{false};
-    for (Particle<nlayer> *pt : this->ass.pt_sys)
-        if (pt->type != undamaged_pt_type)
-            any_damaged = pt->updateParticleStaticDamage() || any_damaged;
-
-    return any_damaged;
+    int undamaged = undamaged_pt_type;
+    return this->ass.arena.forEachAny([undamaged](auto &pt)
+                                      { return pt.type != undamaged && pt.updateParticleStaticDamage(); });
 }
 
 template <int nlayer>
@@ -107,13 +90,9 @@ bool SolverStatic<nlayer>::solveProblemStep(LoadStep<nlayer> &load_step, double
     do
     {
         // update the stiffness matrix using current state variables (bdamage)
-        this->stiffness.reset(this->ass.pt_sys);
         double t11 = omp_get_wtime();
-        if (this->ass.pt_sys[0]->cell.dim == 2)
-            this->stiffness.calcStiffness2D(this->ass.pt_sys);
-        else
-            this->stiffness.calcStiffness3D(this->ass.pt_sys);
-        this->stiffness.updateStiffnessDispBC(this->ass.pt_sys);
+        if (!this->assemblyDeferred())
+            this->updateStiffness();
         double t12 = omp_get_wtime();
         printf("Stiffness matrix calculation costs %f seconds\n", t12 - t11);
 
@@ -122,15 +101,16 @@ bool SolverStatic<nlayer>::solveProblemStep(LoadStep<nlayer> &load_step, double
         if (n_newton >= this->max_NR_iter)
             break;
 
-        this->ass.updateStateVar();
+        if (!this->implicit_state)
+            this->ass.updateStateVar(); // the implicit state is already mapped at the converged positions
         new_damaged = updateStaticDamage();
         this->ass.storeStateVar(); // store converged state variables, last_var = var
 
         if (new_damaged)
         {
             printf("Updating damage\n");
-            this->ass.updateGeometry();
-            this->ass.updateForceState();
+            this->refactor_pending = true; // the next stiffness is factorized in modified Newton
+            this->ass.updateGeometryForceState();
             // this->ass.resetStateVar(false); // reset var = last_var
         }
 
@@ -145,6 +125,7 @@ bool SolverStatic<nlayer>::solveProblemStep(LoadStep<nlayer> &load_step, double
     // std::cout << this->ass.pt_sys[8614]->state_var[0] << ',' << this->ass.pt_sys[8614]->state_var[0] << std::endl;
     // std::cout << m << ',' << this->ass.pt_sys[5030]->damage << ',' << this->ass.pt_sys[5030]->state_var[0] << ',' << this->ass.pt_sys[5030]->state_var[1] << std::endl;
 
+    this->printFactorizations();
     if (n_newton < this->max_NR_iter)
         return true; // normal return
     else
@@ -5,6 +5,7 @@
 #include <vector>
 #include <array>
 #include <algorithm>
+#include <iterator>
 #include <string>
 
 #include "lpm.h"
@@ -21,19 +22,84 @@ class Stiffness
     StiffnessMode mode; // use finite difference or analytical approach to compute local stiffness
 
 public:
-    MKL_INT *IK, *JK;
-    MKL_INT *K_pointer; // start index for each particle in the global stiffness matrix
-    double *residual, *K_global;
+    MKL_INT *IK{nullptr}, *JK{nullptr};
+    MKL_INT *K_pointer{nullptr}; // start index for each particle in the global stiffness matrix
+    double *residual{nullptr}, *K_global{nullptr};
 
-    void initialize(std::vector<Particle<nlayer> *> &pt_sys);
+    int pattern_version{0};              // incremented whenever the sparsity pattern (K_pointer, IK, JK) is rebuilt
+    int system_version{0};               // incremented whenever the pattern of the system handed to the solvers changes
+    int values_version{0};               // incremented with every assembly of the system
+    int bc_version{0};                   // incremented whenever the set of constrained (or fully damaged) DOFs changes
+    std::vector<char> eliminated;        // constrained or fully damaged DOFs of the last assembly
+    std::vector<std::vector<int>> K_num; // for each conn j of particle i, position of the block (i, j) in the block row of the lower id
+
+    std::vector<std::vector<std::array<std::array<double, NDIM>, NDIM>>> K_fd;  // finite difference blocks K_ij of particle j, for each conn i of j
+    std::vector<std::vector<std::array<std::array<double, NDIM>, NDIM>>> K_ad;  // automatic differentiation blocks K_ij of particle j, for each conn i of j
+    std::vector<std::vector<std::array<std::array<double, NDIM>, NDIM>>> K_ana; // analytical blocks K_ij of particle i, for each conn j of i
+    std::vector<std::vector<Particle<nlayer> *>> conn_colors;                   // particles with disjoint conn lists, perturbed (or seeded) together
+    BondTangent<nlayer> tangent;                                                // bond derivatives of the seeded particles, zero elsewhere
+    bool consistent_tangent{false};                                             // add the plastic part of the return mapping tangent (implicit state update)
+    std::vector<std::vector<std::array<std::array<double, NDIM>, 2 * NDIM>>> dsigma_pl; // stress derivative of the plastic particles, for each conn
+    std::vector<std::array<double, 2 * NDIM>> g_pl;                                      // bond force derivative with respect to the owner's stress
+    std::vector<std::array<double, NDIM>> h_pl;                                          // plastic stretch derivative with respect to the bond vector
+    std::vector<char> plastic_pl;                                                        // the last return mapping of the particle was plastic
+
+    bool reduced_system{false};               // eliminate the constrained and fully damaged DOFs instead of zeroing their rows and columns
+    MKL_INT n_dof{0}, n_free{0};              // size of the full and of the reduced system
+    std::vector<MKL_INT> free_dof;            // index of each DOF in the reduced system, -1 if eliminated
+    std::vector<MKL_INT> IK_free, JK_free;    // pattern of the reduced system (one-based, upper triangle)
+    std::vector<std::vector<MKL_INT>> K_free_pos; // for each free row r of particle i and its block b (of the conns j with id >= i), position of the first free entry in K_free, at r * nconn_largeq + b
+    std::vector<double> K_free, residual_free; // values and right hand side of the reduced system
+    int free_version{-1};                     // pattern version the reduced pattern was built from
+
+    bool incremental{false};                              // only recompute the blocks around particles whose bonds changed since the last assembly
+    int full_interval{10};                                // a full assembly after this many incremental ones
+    int n_incremental{0}, assembled_version{-1};          // incremental assemblies since the last full one, and its system version
+    std::vector<double> K_assembled;                      // system matrix of the last assembly, before the displacement BCs
+    std::vector<double> bdamage_asm, dLp_asm, damage_asm; // bond and particle states of the last assembly
+
+    void initialize(std::vector<Particle<nlayer> *> &pt_sys); // sparsity pattern, has to be called again if the conns change
     void reset(std::vector<Particle<nlayer> *> &pt_sys);
     void calcStiffness3D(std::vector<Particle<nlayer> *> &pt_sys);
     void calcStiffness2D(std::vector<Particle<nlayer> *> &pt_sys);
+    void colorConns(std::vector<Particle<nlayer> *> &pt_sys);
+    void resumeState(std::vector<Particle<nlayer> *> &pt_sys);
+    void calcBlocks(std::vector<Particle<nlayer> *> &pt_sys);
+    void calcBlocksFD(std::vector<Particle<nlayer> *> &pt_sys, std::vector<Particle<nlayer> *> &cols); // column blocks of cols
+    void calcBlocksAD(std::vector<Particle<nlayer> *> &pt_sys, std::vector<Particle<nlayer> *> &cols); // column blocks of cols
+    void calcBlocksANA(std::vector<Particle<nlayer> *> &pt_sys, std::vector<Particle<nlayer> *> &rows); // block rows of rows
+    void assembleRow3D(Particle<nlayer> *pi); // adds the upper triangle block row of pi to K_global (or K_free)
+    void assembleRow2D(Particle<nlayer> *pi);
+    void assembleBlockFree(Particle<nlayer> *pi, Particle<nlayer> *pj, int num1, const std::array<std::array<double, NDIM>, NDIM> &K_local);
+    bool calcStiffnessIncremental(std::vector<Particle<nlayer> *> &pt_sys); // false if a full assembly is needed instead
+    void storeAssembled(std::vector<Particle<nlayer> *> &pt_sys, bool full); // reference of the incremental updates
+    void calcPlasticTerms(std::vector<Particle<nlayer> *> &pt_sys);
+    void addPlasticBlocks(std::vector<Particle<nlayer> *> &pt_sys);
     void updateStiffnessDispBC(std::vector<Particle<nlayer> *> &pt_sys);
+    void updateEliminated(std::vector<Particle<nlayer> *> &pt_sys); // constrained or fully damaged DOFs, also without an assembly
+    void multiplyTangent(std::vector<Particle<nlayer> *> &pt_sys, const double *x, double *y); // y = K x of the system with the blocks before the symmetrization
+    void updateSystemPattern(std::vector<Particle<nlayer> *> &pt_sys); // before an assembly, the reduced pattern follows the displacement BCs
+    void reduceSystem(std::vector<Particle<nlayer> *> &pt_sys);
+    void gatherResidual();                                 // right hand side of the reduced system
+    void scatterSolution(const double *x_free, double *x); // solution of the reduced system to all DOFs, zero if eliminated
+
+    // the system handed to the linear solvers, the reduced one if reduced_system is set
+    MKL_INT systemSize() const { return reduced_system ? n_free : n_dof; }
+    MKL_INT *systemIK() { return reduced_system ? IK_free.data() : IK; }
+    MKL_INT *systemJK() { return reduced_system ? JK_free.data() : JK; }
+    double *systemK() { return reduced_system ? K_free.data() : K_global; }
+    double *systemRHS() { return reduced_system ? residual_free.data() : residual; }
+    std::vector<MKL_INT> systemBlocks(int dim); // first DOF of each particle in the system, and its size at the end
+    void systemGraph(std::vector<Particle<nlayer> *> &pt_sys, std::vector<MKL_INT> &g_ptr, std::vector<MKL_INT> &g_adj); // bonded conns of the blocks
+    std::vector<MKL_INT> systemDofs();                                                                                  // system DOF of each DOF, -1 if it is not solved for
+    std::vector<double> systemRigidModes(std::vector<Particle<nlayer> *> &pt_sys, int &nB);                             // near null space of the system
 
-    std::array<std::array<double, NDIM>, NDIM> localStiffness(Particle<nlayer> *pi, Particle<nlayer> *pj);
-    std::array<std::array<double, NDIM>, NDIM> localStiffnessFD(Particle<nlayer> *pi, Particle<nlayer> *pj);
-    std::array<std::array<double, NDIM>, NDIM> localStiffnessANA(Particle<nlayer> *pi, Particle<nlayer> *pj);
+    // block K_ij of particle pi and its k-th conn j
+    std::array<std::array<double, NDIM>, NDIM> localStiffness(Particle<nlayer> *pi, int k);
+    std::array<std::array<double, NDIM>, NDIM> localStiffnessFD(Particle<nlayer> *pi, int k);  // block computed by calcBlocksFD
+    std::array<std::array<double, NDIM>, NDIM> localStiffnessAD(Particle<nlayer> *pi, int k);  // block computed by calcBlocksAD
+    std::array<std::array<double, NDIM>, NDIM> localStiffnessANA(Particle<nlayer> *pi, int k); // block computed by calcBlocksANA
+    std::array<std::array<double, NDIM>, NDIM> &blockRef(Particle<nlayer> *pi, int k);         // storage of localStiffness(pi, k)
 
     Stiffness(std::vector<Particle<nlayer> *> &pt_sys, StiffnessMode p_mode)
     { // Given a particle system, construct a stiffness matrix and solver
@@ -54,6 +120,13 @@ public:
 template <int nlayer>
 void Stiffness<nlayer>::initialize(std::vector<Particle<nlayer> *> &pt_sys)
 {
+    // the pattern only depends on the conns, the assemblies only update K_global
+    delete[] IK;
+    delete[] JK;
+    delete[] residual;
+    delete[] K_pointer;
+    delete[] K_global;
+
     K_pointer = new MKL_INT[pt_sys.size() + 1];
     K_pointer[pt_sys[0]->id] = 0;
     for (auto pt : pt_sys)
@@ -68,301 +141,765 @@ void Stiffness<nlayer>::initialize(std::vector<Particle<nlayer> *> &pt_sys)
     JK = new MKL_INT[K_pointer[pt_sys.size()]]{};
     residual = new double[pt_sys[0]->cell.dim * pt_sys.size()]{};
     K_global = new double[K_pointer[pt_sys.size()]]{};
+
+    // row r of particle i holds the upper triangle of the blocks (i, j), for the conns j with id >= i, i.e., its
+    // entries start at K_pointer[i] + r * dim * nconn_largeq - r * (r + 1) / 2 (the lower part of the diagonal block is left out)
+    K_num.resize(pt_sys.size());
+#pragma omp parallel for
+    for (Particle<nlayer> *pi : pt_sys)
+    {
+        int dim = pi->cell.dim, idx_i = pi->nconn - pi->nconn_largeq; // index of pi in its own conn list
+        for (int r = 0; r < dim; ++r)
+        {
+            MKL_INT row = K_pointer[pi->id] + r * dim * (pi->nconn_largeq) - r * (r + 1) / 2;
+            IK[dim * pi->id + r] = row + r + 1;
+            for (int idx_j = idx_i; idx_j < pi->nconn; ++idx_j)
+            {
+                for (int s = (idx_j == idx_i) ? r : 0; s < dim; ++s)
+                    JK[row + dim * (idx_j - idx_i) + s] = dim * pi->conns[idx_j]->id + s + 1;
+            }
+        }
+
+        K_num[pi->id].resize(pi->nconn);
+        for (int idx_j = 0; idx_j < pi->nconn; ++idx_j)
+        {
+            Particle<nlayer> *pj = pi->conns[idx_j];
+            if (idx_j >= idx_i)
+                K_num[pi->id][idx_j] = idx_j - idx_i;
+            else
+                K_num[pi->id][idx_j] = pi->conn_slot[idx_j] - (pj->nconn - pj->nconn_largeq);
+        }
+    }
+    IK[pt_sys[0]->cell.dim * pt_sys.size()] = K_pointer[pt_sys.size()] + 1;
+    n_dof = pt_sys[0]->cell.dim * pt_sys.size();
+    ++pattern_version;
+    ++system_version;
+
+    if (mode != StiffnessMode::Analytical)
+        colorConns(pt_sys);
 }
 
 template <int nlayer>
-void Stiffness<nlayer>::reset(std::vector<Particle<nlayer> *> &pt_sys)
+void Stiffness<nlayer>::colorConns(std::vector<Particle<nlayer> *> &pt_sys)
 {
-    for (auto pt : pt_sys)
+    // greedy distance-2 coloring of the conn graph: the conn lists of two particles of the same color do not overlap,
+    // i.e., their columns of the stiffness matrix are structurally orthogonal (Curtis-Powell-Reid)
+    std::vector<int> color(pt_sys.size(), -1), forbidden; // forbidden[c] is the last particle that can not take color c
+    conn_colors.clear();
+    for (Particle<nlayer> *pj : pt_sys)
     {
-        if (pt->cell.dim == 2)
-            K_pointer[pt->id + 1] = K_pointer[pt->id] + (pt->cell.dim) * (pt->cell.dim) * (pt->nconn_largeq) - 1;
-        else
-            K_pointer[pt->id + 1] = K_pointer[pt->id] + (pt->cell.dim) * (pt->cell.dim) * (pt->nconn_largeq) - 3;
-    }
+        for (Particle<nlayer> *pi : pj->conns)
+        {
+            for (Particle<nlayer> *pk : pi->conns)
+            {
+                if (color[pk->id] >= 0)
+                    forbidden[color[pk->id]] = pj->id;
+            }
+        }
 
-    for (int i = 0; i < K_pointer[pt_sys.size()]; ++i)
-    {
-        JK[i] = 0;
-        K_global[i] = 0;
+        int c = 0;
+        while (c < (int)forbidden.size() && forbidden[c] == pj->id)
+            ++c;
+        if (c == (int)forbidden.size())
+        {
+            forbidden.push_back(-1);
+            conn_colors.emplace_back();
+        }
+        color[pj->id] = c;
+        conn_colors[c].push_back(pj);
     }
+    printf("Stiffness blocks are computed in %d colors of particles\n", (int)conn_colors.size());
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::reset(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    // values only, the pattern is kept
+    updateSystemPattern(pt_sys);
+    if (reduced_system)
+        std::fill(K_free.begin(), K_free.end(), 0.0);
+    else
+        std::fill(K_global, K_global + K_pointer[pt_sys.size()], 0.0);
 }
 
 template <int nlayer>
-std::array<std::array<double, NDIM>, NDIM> Stiffness<nlayer>::localStiffness(Particle<nlayer> *pi, Particle<nlayer> *pj)
+std::array<std::array<double, NDIM>, NDIM> Stiffness<nlayer>::localStiffness(Particle<nlayer> *pi, int k)
 {
     if (mode == StiffnessMode::Analytical)
-        return localStiffnessANA(pi, pj);
-    return localStiffnessFD(pi, pj);
+        return localStiffnessANA(pi, k);
+    if (mode == StiffnessMode::AutomaticDifferentiation)
+        return localStiffnessAD(pi, k);
+    return localStiffnessFD(pi, k);
 }
 
-std::array<std::array<double, NDIM>, NDIM> sumArray(std::array<std::array<double, NDIM>, NDIM> &a, std::array<std::array<double, NDIM>, NDIM> &b)
+template <int nlayer>
+void Stiffness<nlayer>::calcBlocks(std::vector<Particle<nlayer> *> &pt_sys)
 {
-    std::array<std::array<double, NDIM>, NDIM> local;
-    for (int i = 0; i < NDIM; i++)
-        for (int j = 0; j < NDIM; j++)
-            local[i][j] = a[i][j] + b[i][j];
-    return local;
+    // the finite difference and dual blocks touch shared particle (or tangent) states, so they run before the parallel assembly
+    // the plastic terms are taken first, the finite difference perturbations run the return mapping again
+    if (consistent_tangent)
+        calcPlasticTerms(pt_sys);
+
+    if (mode == StiffnessMode::FiniteDifference)
+        calcBlocksFD(pt_sys, pt_sys);
+    else if (mode == StiffnessMode::AutomaticDifferentiation)
+        calcBlocksAD(pt_sys, pt_sys);
+    else
+        calcBlocksANA(pt_sys, pt_sys);
+
+    if (consistent_tangent)
+        addPlasticBlocks(pt_sys);
 }
 
 template <int nlayer>
-std::array<std::array<double, NDIM>, NDIM> Stiffness<nlayer>::localStiffnessANA(Particle<nlayer> *pi, Particle<nlayer> *pj)
+std::array<std::array<double, NDIM>, NDIM> &Stiffness<nlayer>::blockRef(Particle<nlayer> *pi, int k)
 {
-    bool flag1{false}, flag2{false};
-    std::array<std::array<double, NDIM>, NDIM> K_local{0}, K_temp1{0}, K_temp2{0};
-    if (pi->hasAFEMneighbor(pj, 0))
+    if (mode == StiffnessMode::Analytical)
+        return K_ana[pi->id][k];
+    if (mode == StiffnessMode::AutomaticDifferentiation)
+        return K_ad[pi->conns[k]->id][pi->conn_slot[k]];
+    return K_fd[pi->conns[k]->id][pi->conn_slot[k]];
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::calcPlasticTerms(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    // for particles whose last return mapping was plastic: their bond forces change by g_b . d(stress) (dFpl2dsigma) and
+    // their stress by S_j dx_j for each conn j (dsigma2dxyz), the plastic stretch of the bonds also turns with the bond (dLp2dxyz)
+    dsigma_pl.resize(pt_sys.size());
+    g_pl.resize(pt_sys[0]->bonds->nbond);
+    h_pl.resize(pt_sys[0]->bonds->nbond);
+    plastic_pl.assign(pt_sys.size(), 0);
+
+#pragma omp parallel
     {
-        K_temp1 = fdu2dxyz1(pi, pj);
-        flag1 = true;
+        std::vector<int> slot(pt_sys.size(), -1);
+        std::array<std::array<double, 2 * NDIM>, 2 * NDIM> dep_dsigma;
+        std::array<double, 2 * NDIM> dplstrain;
+
+#pragma omp for
+        for (Particle<nlayer> *p : pt_sys)
+        {
+            if (!p->plasticTangent(dep_dsigma, dplstrain))
+            {
+                dsigma_pl[p->id].clear();
+                continue;
+            }
+            plastic_pl[p->id] = 1;
+            for (int k = 0; k < p->nconn; ++k)
+                slot[p->conns[k]->id] = k;
+            dsigma2dxyz(p, slot, dsigma_pl[p->id]);
+            dFpl2dsigma(p, dep_dsigma, g_pl);
+            dLp2dxyz(p, dplstrain, h_pl);
+        }
     }
-    if (pi->hasAFEMneighbor(pj, 1))
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::addPlasticBlocks(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    // plastic part of the consistent tangent (see calcPlasticTerms), the return mapping of a particle reaches its own force
+    // and the force of its neighbors through the opposite bonds; terms of a neighbor's return mapping outside the conns of the
+    // row (only with the narrow conns) are lumped into the diagonal block, which keeps the block rows summing to zero
+    BondStore<nlayer> &bs = *pt_sys[0]->bonds;
+
+#pragma omp parallel
     {
-        K_temp2 = fdu2dxyz2(pi, pj);
-        flag2 = true;
+        std::vector<int> slot(pt_sys.size(), -1); // -1 outside the conns of the current row
+
+#pragma omp for
+        for (Particle<nlayer> *pi : pt_sys)
+        {
+            for (int k = 0; k < pi->nconn; ++k)
+                slot[pi->conns[k]->id] = k;
+
+            // K_ij += f * u v^T
+            auto addOuter = [&](Particle<nlayer> *pj, const std::array<double, NDIM> &u, const std::array<double, NDIM> &v, double f)
+            {
+                std::array<std::array<double, NDIM>, NDIM> &K_ij = blockRef(pi, slot[pj->id] < 0 ? slot[pi->id] : slot[pj->id]);
+                for (int r = 0; r < NDIM; r++)
+                    for (int s = 0; s < NDIM; s++)
+                        K_ij[r][s] += f * u[r] * v[s];
+            };
+
+            std::array<std::array<double, 2 * NDIM>, NDIM> R{0}; // sum of c_b g_b over the bonds of pi
+            for (int i = 0; i < nlayer; i++)
+            {
+                // own return mapping, through the stress (R below) and the turning of the plastic stretch
+                if (plastic_pl[pi->id])
+                {
+                    std::array<double, NDIM> t{0}, h_sum{0};
+                    for (int bd = pi->bond_ptr[i]; bd < pi->bond_ptr[i + 1]; ++bd)
+                    {
+                        std::array<double, NDIM> c{bs.csx[bd], bs.csy[bd], bs.csz[bd]};
+                        double w = 1 - bs.bdamage[bd];
+                        for (int r = 0; r < NDIM; r++)
+                        {
+                            for (int q = 0; q < 2 * NDIM; q++)
+                                R[r][q] += c[r] * g_pl[bd][q];
+                            t[r] -= 0.5 * c[r] * w * 2 * bs.Tv[bd];
+                            h_sum[r] += h_pl[bd][r];
+                        }
+                        addOuter(pi, c, h_pl[bd], -0.5 * w * 2 * bs.Kn[bd]);
+                        addOuter(bs.p2[bd], c, h_pl[bd], 0.5 * w * 2 * bs.Kn[bd]);
+                    }
+                    addOuter(pi, t, h_sum, 1.0);
+                    for (int bd = pi->bond_ptr[i]; bd < pi->bond_ptr[i + 1]; ++bd)
+                        addOuter(bs.p2[bd], t, h_pl[bd], -1.0);
+                }
+
+                // return mapping of the neighbors, through the opposite bonds
+                for (int bd = pi->bond_ptr[i]; bd < pi->bond_ptr[i + 1]; ++bd)
+                {
+                    Particle<nlayer> *pk = bs.p2[bd];
+                    if (!plastic_pl[pk->id])
+                        continue;
+                    int op = bs.op[bd];
+                    std::array<double, NDIM> c{bs.csx[bd], bs.csy[bd], bs.csz[bd]}, h_sum{0};
+                    double w = 1 - bs.bdamage[op];
+
+                    for (int m = 0; m < pk->nconn; ++m)
+                    {
+                        std::array<double, NDIM> gS{0};
+                        for (int s = 0; s < NDIM; s++)
+                            for (int q = 0; q < 2 * NDIM; q++)
+                                gS[s] += g_pl[op][q] * dsigma_pl[pk->id][m][q][s];
+                        addOuter(pk->conns[m], c, gS, 0.5);
+                    }
+
+                    addOuter(pk, c, h_pl[op], -0.5 * w * 2 * bs.Kn[op]);
+                    addOuter(pi, c, h_pl[op], 0.5 * w * 2 * bs.Kn[op]);
+                    for (int bd2 = pk->bond_ptr[i]; bd2 < pk->bond_ptr[i + 1]; ++bd2)
+                    {
+                        for (int r = 0; r < NDIM; r++)
+                            h_sum[r] += h_pl[bd2][r];
+                        addOuter(bs.p2[bd2], c, h_pl[bd2], 0.5 * w * 2 * bs.Tv[op]);
+                    }
+                    addOuter(pk, c, h_sum, -0.5 * w * 2 * bs.Tv[op]);
+                }
+            }
+
+            if (plastic_pl[pi->id])
+            {
+                for (int m = 0; m < pi->nconn; ++m)
+                {
+                    std::array<std::array<double, NDIM>, NDIM> &K_ij = blockRef(pi, m);
+                    for (int r = 0; r < NDIM; r++)
+                        for (int s = 0; s < NDIM; s++)
+                            for (int q = 0; q < 2 * NDIM; q++)
+                                K_ij[r][s] += 0.5 * R[r][q] * dsigma_pl[pi->id][m][q][s];
+                }
+            }
+
+            for (int k = 0; k < pi->nconn; ++k)
+                slot[pi->conns[k]->id] = -1;
+        }
     }
+}
 
-    if (pi->id == pj->id)
+template <int nlayer>
+void Stiffness<nlayer>::calcBlocksANA(std::vector<Particle<nlayer> *> &pt_sys, std::vector<Particle<nlayer> *> &rows)
+{
+    // block rows straight from the bonds, see fdu2dxyzRow
+    K_ana.resize(pt_sys.size());
+#pragma omp parallel
     {
-        K_local = fdu2dxyz(pi);
-        // if (pi->id == 40)
-        // {
-        //     printf("%f, %f, %f\n%f, %f, %f\n%f, %f, %f\n\n", K_local[0][0], K_local[0][1], K_local[0][2],
-        //            K_local[1][0], K_local[1][1], K_local[1][2],
-        //            K_local[2][0], K_local[2][1], K_local[2][2]);
-        // }
+        std::vector<int> slot(pt_sys.size(), -1); // position of a particle in the conn list of the current particle
+        std::vector<std::array<std::array<double, NDIM>, NDIM>> K_work;
+
+#pragma omp for
+        for (Particle<nlayer> *pi : rows)
+        {
+            for (int k = 0; k < pi->nconn; ++k)
+                slot[pi->conns[k]->id] = k;
+            if ((int)K_work.size() < pi->nconn)
+                K_work.resize(pi->nconn, std::array<std::array<double, NDIM>, NDIM>{0});
+
+            K_ana[pi->id].assign(pi->nconn, std::array<std::array<double, NDIM>, NDIM>{0});
+            fdu2dxyzRow(pi, slot, K_ana[pi->id], K_work);
+        }
     }
-    else if (flag1 && flag2)
-        K_local = sumArray(K_temp1, K_temp2);
-    else if (flag1)
-        K_local = K_temp1;
-    else if (flag2)
-        K_local = K_temp2;
+}
 
-    return K_local;
+template <int nlayer>
+std::array<std::array<double, NDIM>, NDIM> Stiffness<nlayer>::localStiffnessANA(Particle<nlayer> *pi, int k)
+{
+    return K_ana[pi->id][k];
 }
 
 template <int nlayer>
-std::array<std::array<double, NDIM>, NDIM> Stiffness<nlayer>::localStiffnessFD(Particle<nlayer> *pi, Particle<nlayer> *pj)
+void Stiffness<nlayer>::resumeState(std::vector<Particle<nlayer> *> &pt_sys)
 {
-    std::vector<double> K_ij;
-    std::array<double, NDIM> xyz_temp = pj->xyz;
+    // resumeParticleState of the given particles (the whole system in general)
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        pt->resetParticleStateVariables();
+        pt->updateBondsGeometry();
+    }
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : pt_sys)
+        pt->updateBondsForce();
+}
 
-    // common conns particles
-    // std::vector<Particle<nlayer> *> common_conns;
-    // set_intersection(pi->conns.begin(), pi->conns.end(), pj->conns.begin(), pj->conns.end(), back_inserter(common_conns));
+template <int nlayer>
+void Stiffness<nlayer>::calcBlocksFD(std::vector<Particle<nlayer> *> &pt_sys, std::vector<Particle<nlayer> *> &cols)
+{
+    // all particles of one color are perturbed at once, the force change of each of their conns i gives the column block
+    // K_ij of the only perturbed particle j it is connected to, so all blocks of the matrix come from ncolor * dim
+    // perturbations, each of them a parallel sweep over the conns of the color
+    K_fd.resize(pt_sys.size());
+    std::vector<std::array<double, NDIM>> xyz_ref(pt_sys.size()), Pin_ref(pt_sys.size());
 
-    pi->updateParticleForce(); // update pi particle internal forces
+    // bring all particles to the resumed state first (the displacement BCs have moved particles since the last force
+    // update), so that the unperturbed forces do not depend on the order in which the particles are perturbed; the
+    // consistent tangent is taken at the current Newton iterate instead, with its plastic stretch kept fixed (the return
+    // mapping is added by addPlasticBlocks), as the forces of the iterate are computed from it
+    if (consistent_tangent)
+    {
+#pragma omp parallel for
+        for (Particle<nlayer> *pt : pt_sys)
+            pt->updateBondsGeometry();
+#pragma omp parallel for
+        for (Particle<nlayer> *pt : pt_sys)
+            pt->updateBondsForce();
+    }
+    else
+        resumeState(pt_sys);
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        pt->updateParticleForce();
+        xyz_ref[pt->id] = pt->xyz;
+        Pin_ref[pt->id] = pt->Pin;
+    }
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : cols)
+        K_fd[pt->id].assign(pt->nconn, std::array<std::array<double, NDIM>, NDIM>{0});
 
-    std::array<double, NDIM> Pin_temp = pi->Pin;
-    // printf("id: %d, %f, %f, %f\n", pi->id, Pin_temp[0], Pin_temp[1], Pin_temp[2]);
+    bool all_cols = (cols.size() == pt_sys.size());
+    std::vector<char> in_cols(pt_sys.size(), all_cols);
+    for (Particle<nlayer> *pt : cols)
+        in_cols[pt->id] = 1;
 
-    for (int r = 0; r < pj->cell.dim; ++r)
+    for (std::vector<Particle<nlayer> *> &color : conn_colors)
     {
-        xyz_temp[r] += EPS * pj->cell.radius; // forward-difference
-        pj->moveTo(xyz_temp);                 // move to a new position
-
-        // update bforce of all common conns (need to update all nonlocal geometry and state variables before bforce calculation)
-        for (Particle<nlayer> *pjj : pj->conns)
-            pjj->updateBondsGeometry(); // update all bond information, e.g., dL, dL_total
+        // only the particles of cols in the color are perturbed
+        std::vector<Particle<nlayer> *> sub;
+        if (!all_cols)
+            std::copy_if(color.begin(), color.end(), std::back_inserter(sub), [&in_cols](Particle<nlayer> *pt)
+                         { return in_cols[pt->id] != 0; });
+        std::vector<Particle<nlayer> *> &group = all_cols ? color : sub;
+        if (group.empty())
+            continue;
 
-        for (Particle<nlayer> *pjj : pj->conns)
-            pjj->updateParticleStateVariables();
+        for (int r = 0; r < pt_sys[0]->cell.dim; ++r)
+        {
+            // move the particles of the color and update their conns, a conn only sees the particle it belongs to
+#pragma omp parallel for
+            for (Particle<nlayer> *pj : group)
+            {
+                std::array<double, NDIM> xyz_temp = xyz_ref[pj->id];
+                xyz_temp[r] += EPS * pj->cell.radius; // forward-difference
+                pj->moveTo(xyz_temp);
 
-        for (Particle<nlayer> *pjj : pj->conns)
-            pjj->updateBondsForce(); // update all bond forces
+                for (Particle<nlayer> *pjj : pj->conns)
+                {
+                    pjj->updateBondsGeometry(); // update all bond information, e.g., dL, dL_total
+                    if (!consistent_tangent)
+                        pjj->updateParticleStateVariables();
+                    pjj->updateBondsForce(); // update all bond forces
+                }
+            }
 
-        pi->updateParticleForce(); // update pi particle internal forces
+            // internal forces of the conns, they read the opposite bond forces of their neighbors
+#pragma omp parallel for
+            for (Particle<nlayer> *pj : group)
+            {
+                std::vector<std::array<std::array<double, NDIM>, NDIM>> &K_j = K_fd[pj->id];
+                for (int k = 0; k < pj->nconn; ++k)
+                {
+                    Particle<nlayer> *pi = pj->conns[k];
+                    pi->updateParticleForce();
+                    for (int s = 0; s < pi->cell.dim; s++)
+                        K_j[k][s][r] = (pi->Pin[s] - Pin_ref[pi->id][s]) / EPS / (pi->cell.radius);
+                }
+            }
 
-        for (int s = 0; s < pi->cell.dim; s++)
-        {
-            double K_value = (pi->Pin[s] - Pin_temp[s]) / EPS / (pi->cell.radius);
-            K_ij.push_back(K_value); // for each K_ij, index order is 11, 12, 13, 21, ..., 32, 33
-            // if(pi->id == 20)
-            // printf("%f, ", K_value);
+            // resume the original state of the color (the state variables were not changed with the consistent tangent)
+#pragma omp parallel for
+            for (Particle<nlayer> *pj : group)
+            {
+                pj->moveTo(xyz_ref[pj->id]);
+                if (!consistent_tangent)
+                {
+                    pj->resumeParticleState();
+                    continue;
+                }
+                for (Particle<nlayer> *pjj : pj->conns)
+                    pjj->updateBondsGeometry();
+                for (Particle<nlayer> *pjj : pj->conns)
+                    pjj->updateBondsForce();
+            }
         }
+    }
 
-        // resume the particle's original state
-        xyz_temp[r] -= EPS * pj->cell.radius; // move back the particle position
-        pj->moveTo(xyz_temp);
-        pj->resumeParticleState();
-    } // K_ij has finished
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : pt_sys)
+        pt->Pin = Pin_ref[pt->id];
+}
 
-    std::array<std::array<double, NDIM>, NDIM> K_local{0};
-    for (int r = 0; r < pi->cell.dim; r++)
-        for (int s = 0; s < pi->cell.dim; s++)
-            K_local[r][s] = K_ij[pi->cell.dim * s + r];
-    return K_local;
+template <int nlayer>
+std::array<std::array<double, NDIM>, NDIM> Stiffness<nlayer>::localStiffnessFD(Particle<nlayer> *pi, int k)
+{
+    return K_fd[pi->conns[k]->id][pi->conn_slot[k]]; // column blocks of j
 }
 
 template <int nlayer>
-void Stiffness<nlayer>::calcStiffness3D(std::vector<Particle<nlayer> *> &pt_sys)
+void Stiffness<nlayer>::calcBlocksAD(std::vector<Particle<nlayer> *> &pt_sys, std::vector<Particle<nlayer> *> &cols)
 {
-    // std::fill(K_global.begin(), K_global.end(), 0.0);
+    // forward-mode automatic differentiation of the internal forces, the particles of one color are seeded in one
+    // direction at once (as they are perturbed in calcBlocksFD), so the dual sweeps give exact blocks K_ij for every conn
+    // i of a seeded particle j, the bond store is only read and no state has to be resumed afterwards
+    K_ad.resize(pt_sys.size());
+    tangent.resize(pt_sys[0]->bonds->nbond);
+    std::vector<int> seed(pt_sys.size(), -1); // seeded direction of each particle
+
+    bool all_cols = (cols.size() == pt_sys.size());
+    std::vector<char> in_cols(pt_sys.size(), all_cols);
+    for (Particle<nlayer> *pt : cols)
+        in_cols[pt->id] = 1;
+
+    // same state as the unperturbed one of calcBlocksFD, but only for the particles the seeded columns touch: their conns,
+    // whose bonds are differentiated, and the neighbors of these, whose opposite bond forces are read; the consistent
+    // tangent is taken at the current Newton iterate (see calcBlocksFD), the bond store is read as it is
+    if (all_cols && !consistent_tangent)
+        resumeState(pt_sys);
+    else if (!consistent_tangent)
+    {
+        std::vector<char> touched(pt_sys.size(), 0);
+        std::vector<Particle<nlayer> *> pt_touched;
+        for (Particle<nlayer> *pj : cols)
+            for (Particle<nlayer> *pjj : pj->conns)
+            {
+                if (touched[pjj->id] == 0)
+                {
+                    touched[pjj->id] = 1;
+                    pt_touched.push_back(pjj);
+                }
+            }
+        int n_conns = (int)pt_touched.size();
+        for (int k = 0; k < n_conns; ++k)
+            for (Particle<nlayer> *p2 : pt_touched[k]->neighbors)
+                if (touched[p2->id] == 0)
+                {
+                    touched[p2->id] = 1;
+                    pt_touched.push_back(p2);
+                }
+        resumeState(pt_touched);
+    }
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : cols)
+        K_ad[pt->id].assign(pt->nconn, std::array<std::array<double, NDIM>, NDIM>{0});
 
-#pragma omp parallel for if (mode == StiffnessMode::Analytical)
-    for (const auto &pi_iterator : pt_sys | indexed(0))
+    for (std::vector<Particle<nlayer> *> &color : conn_colors)
     {
-        Particle<nlayer> *pi = pi_iterator.value();
+        // only the particles of cols in the color are perturbed
+        std::vector<Particle<nlayer> *> sub;
+        if (!all_cols)
+            std::copy_if(color.begin(), color.end(), std::back_inserter(sub), [&in_cols](Particle<nlayer> *pt)
+                         { return in_cols[pt->id] != 0; });
+        std::vector<Particle<nlayer> *> &group = all_cols ? color : sub;
+        if (group.empty())
+            continue;
 
-        for (const auto &pj_iterator : pi->conns | indexed(0))
+        for (int r = 0; r < pt_sys[0]->cell.dim; ++r)
         {
-            int idx_j = (int)pj_iterator.index();
-            Particle<nlayer> *pj = pj_iterator.value();
-            std::array<std::array<double, NDIM>, NDIM> K_local = localStiffness(pi, pj);
-
-            // if (pi->id == 30)
-            // {
-            //     printf("j: %d, %f, %f, %f\n%f, %f, %f\n%f, %f, %f\n\n", pj->id, K_local[0][0], K_local[0][1], K_local[0][2],
-            //            K_local[1][0], K_local[1][1], K_local[1][2],
-            //            K_local[2][0], K_local[2][1], K_local[2][2]);
-            // }
-
-            if (pi->id == pj->id)
+            // bond derivatives of the conns, a conn only sees the seeded particle it belongs to
+#pragma omp parallel for
+            for (Particle<nlayer> *pj : group)
             {
-                K_global[K_pointer[pi->id]] += K_local[0][0];
-                K_global[K_pointer[pi->id] + 1] += K_local[0][1];
-                K_global[K_pointer[pi->id] + 2] += K_local[0][2];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq)] += K_local[1][1];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + 1] += K_local[1][2];
-                K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) - 1] += K_local[2][2];
-
-                JK[K_pointer[pi->id]] = pi->cell.dim * (pj->id + 1) - 2;
-                JK[K_pointer[pi->id] + 1] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + 2] = pi->cell.dim * (pj->id + 1);
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq)] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + 1] = pi->cell.dim * (pj->id + 1);
-                JK[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) - 1] = pi->cell.dim * (pj->id + 1);
+                seed[pj->id] = r;
+                for (Particle<nlayer> *pjj : pj->conns)
+                    pjj->updateBondsTangent(seed, tangent);
             }
-            else if (pj->id > pi->id)
+
+            // force derivatives of the conns, they read the opposite bond derivatives of their neighbors
+#pragma omp parallel for
+            for (Particle<nlayer> *pj : group)
             {
-                int num1 = pi->nconn_largeq - (pi->nconn - idx_j); // index difference between i and j, in i's conn list
-                // if (pi->id == 30)
-                //     printf("%d, ", num1);
-                K_global[K_pointer[pi->id] + pi->cell.dim * num1] += 0.5 * K_local[0][0];
-                K_global[K_pointer[pi->id] + pi->cell.dim * num1 + 1] += 0.5 * K_local[0][1];
-                K_global[K_pointer[pi->id] + pi->cell.dim * num1 + 2] += 0.5 * K_local[0][2];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] += 0.5 * K_local[1][0];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1] += 0.5 * K_local[1][1];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 + 1] += 0.5 * K_local[1][2];
-                K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 3] += 0.5 * K_local[2][0];
-                K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 2] += 0.5 * K_local[2][1];
-                K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] += 0.5 * K_local[2][2];
-
-                JK[K_pointer[pi->id] + pi->cell.dim * num1] = pi->cell.dim * (pj->id + 1) - 2;
-                JK[K_pointer[pi->id] + pi->cell.dim * num1 + 1] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + pi->cell.dim * num1 + 2] = pi->cell.dim * (pj->id + 1);
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] = pi->cell.dim * (pj->id + 1) - 2;
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 + 1] = pi->cell.dim * (pj->id + 1);
-                JK[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 3] = pi->cell.dim * (pj->id + 1) - 2;
-                JK[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 2] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] = pi->cell.dim * (pj->id + 1);
+                std::vector<std::array<std::array<double, NDIM>, NDIM>> &K_j = K_ad[pj->id];
+                for (int k = 0; k < pj->nconn; ++k)
+                {
+                    Particle<nlayer> *pi = pj->conns[k];
+                    std::array<double, NDIM> dPin = pi->updateParticleForceTangent(tangent);
+                    for (int s = 0; s < pi->cell.dim; s++)
+                        K_j[k][s][r] = dPin[s];
+                }
             }
-            else
+
+            // the tangent is zero outside of the seeded conns
+#pragma omp parallel for
+            for (Particle<nlayer> *pj : group)
             {
-                auto pt_i = std::find(pj->conns.begin(), pj->conns.end(), pi);
-                int num2 = pj->nconn_largeq - (int)std::distance(pt_i, pj->conns.end());
-                // if (pi->id == 40)
-                //      printf("%d, ", num2);
-                K_global[K_pointer[pj->id] + pi->cell.dim * num2] += 0.5 * K_local[0][0];
-                K_global[K_pointer[pj->id] + pi->cell.dim * num2 + 1] += 0.5 * K_local[1][0];
-                K_global[K_pointer[pj->id] + pi->cell.dim * num2 + 2] += 0.5 * K_local[2][0];
-                K_global[K_pointer[pj->id] + pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2 - 1] += 0.5 * K_local[0][1];
-                K_global[K_pointer[pj->id] + pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2] += 0.5 * K_local[1][1];
-                K_global[K_pointer[pj->id] + pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2 + 1] += 0.5 * K_local[2][1];
-                K_global[K_pointer[pj->id] + 2 * pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2 - 3] += 0.5 * K_local[0][2];
-                K_global[K_pointer[pj->id] + 2 * pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2 - 2] += 0.5 * K_local[1][2];
-                K_global[K_pointer[pj->id] + 2 * pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2 - 1] += 0.5 * K_local[2][2];
+                seed[pj->id] = -1;
+                for (Particle<nlayer> *pjj : pj->conns)
+                    pjj->clearBondsTangent(tangent);
             }
-
-            // if (pi->id == 40)
-            //     printf("%f, ", K_global[K_pointer[pj->id] + pi->cell.dim * 1 + 1]);
         }
-
-        IK[pi->cell.dim * pi->id] = K_pointer[pi->id] + 1;
-        IK[pi->cell.dim * pi->id + 1] = K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + 1;
-        IK[pi->cell.dim * pi->id + 2] = K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq);
-        // if (pi->id == 40)
-        //     printf("%d, ", IK[pi->cell.dim * pi->id]);
     }
-    IK[pt_sys[0]->cell.dim * pt_sys.size()] = K_pointer[pt_sys.size()] + 1;
 }
 
 template <int nlayer>
-void Stiffness<nlayer>::calcStiffness2D(std::vector<Particle<nlayer> *> &pt_sys)
+std::array<std::array<double, NDIM>, NDIM> Stiffness<nlayer>::localStiffnessAD(Particle<nlayer> *pi, int k)
 {
-    // std::fill(K_global.begin(), K_global.end(), 0.0);
+    return K_ad[pi->conns[k]->id][pi->conn_slot[k]]; // column blocks of j
+}
 
-#pragma omp parallel for if (mode == StiffnessMode::Analytical)
-    for (const auto &pi_iterator : pt_sys | indexed(0))
+template <int nlayer>
+void Stiffness<nlayer>::calcStiffness3D(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    calcBlocks(pt_sys);
+
+    // owner computes: particle i owns its block row of the upper triangle (conns j with id >= i), and computes both
+    // K_ij and K_ji of it, so the threads never write the same entries and the matrix is independent of the thread count
+#pragma omp parallel for
+    for (Particle<nlayer> *pi : pt_sys)
+        assembleRow3D(pi);
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::assembleRow3D(Particle<nlayer> *pi)
+{
+    int idx_i = pi->nconn - pi->nconn_largeq; // index of pi in its own conn list
+    for (int idx_j = idx_i; idx_j < pi->nconn; ++idx_j)
     {
-        Particle<nlayer> *pi = pi_iterator.value();
+        Particle<nlayer> *pj = pi->conns[idx_j];
 
-        for (const auto &pj_iterator : pi->conns | indexed(0))
+        if (pi->id == pj->id)
         {
-            int idx_j = (int)pj_iterator.index();
-            Particle<nlayer> *pj = pj_iterator.value();
-            std::array<std::array<double, NDIM>, NDIM> K_local = localStiffness(pi, pj);
-
-            // if (pi->id == 0)
-            // {
-            //     printf("j: %d, %f, %f, %f\n%f, %f, %f\n%f, %f, %f\n\n", pj->id, K_local[0][0], K_local[0][1], K_local[0][2],
-            //            K_local[1][0], K_local[1][1], K_local[1][2],
-            //            K_local[2][0], K_local[2][1], K_local[2][2]);
-            // }
-
-            if (pi->id == pj->id)
+            std::array<std::array<double, NDIM>, NDIM> K_local = localStiffness(pi, idx_j);
+            if (reduced_system)
             {
-                K_global[K_pointer[pi->id]] += K_local[0][0];
-                K_global[K_pointer[pi->id] + 1] += K_local[0][1];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq)] += K_local[1][1];
+                assembleBlockFree(pi, pj, 0, K_local);
+                continue;
+            }
 
-                JK[K_pointer[pi->id]] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + 1] = pi->cell.dim * (pj->id + 1);
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq)] = pi->cell.dim * (pj->id + 1);
+            K_global[K_pointer[pi->id]] += K_local[0][0];
+            K_global[K_pointer[pi->id] + 1] += K_local[0][1];
+            K_global[K_pointer[pi->id] + 2] += K_local[0][2];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq)] += K_local[1][1];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + 1] += K_local[1][2];
+            K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) - 1] += K_local[2][2];
+        }
+        else
+        {
+            // symmetrized block, 0.5 * (K_ij + K_ji^T)
+            std::array<std::array<double, NDIM>, NDIM> K_ij = localStiffness(pi, idx_j), K_ji = localStiffness(pj, pi->conn_slot[idx_j]), K_local;
+            for (int r = 0; r < NDIM; ++r)
+                for (int s = 0; s < NDIM; ++s)
+                    K_local[r][s] = 0.5 * K_ij[r][s] + 0.5 * K_ji[s][r];
+
+            int num1 = idx_j - idx_i; // index difference between i and j, in i's conn list
+            if (reduced_system)
+            {
+                assembleBlockFree(pi, pj, num1, K_local);
+                continue;
             }
-            else if (pj->id > pi->id)
+            K_global[K_pointer[pi->id] + pi->cell.dim * num1] += K_local[0][0];
+            K_global[K_pointer[pi->id] + pi->cell.dim * num1 + 1] += K_local[0][1];
+            K_global[K_pointer[pi->id] + pi->cell.dim * num1 + 2] += K_local[0][2];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] += K_local[1][0];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1] += K_local[1][1];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 + 1] += K_local[1][2];
+            K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 3] += K_local[2][0];
+            K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 2] += K_local[2][1];
+            K_global[K_pointer[pi->id] + 2 * pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] += K_local[2][2];
+        }
+    }
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::calcStiffness2D(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    calcBlocks(pt_sys);
+
+    // owner computes, see calcStiffness3D
+#pragma omp parallel for
+    for (Particle<nlayer> *pi : pt_sys)
+        assembleRow2D(pi);
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::assembleRow2D(Particle<nlayer> *pi)
+{
+    int idx_i = pi->nconn - pi->nconn_largeq; // index of pi in its own conn list
+    for (int idx_j = idx_i; idx_j < pi->nconn; ++idx_j)
+    {
+        Particle<nlayer> *pj = pi->conns[idx_j];
+
+        if (pi->id == pj->id)
+        {
+            std::array<std::array<double, NDIM>, NDIM> K_local = localStiffness(pi, idx_j);
+            if (reduced_system)
             {
-                int num1 = pi->nconn_largeq - (pi->nconn - idx_j); // index difference between i and j, in i's conn list
-                // if (pi->id == 30)
-                //     printf("%d, ", num1);
-                K_global[K_pointer[pi->id] + pi->cell.dim * num1] += 0.5 * K_local[0][0];
-                K_global[K_pointer[pi->id] + pi->cell.dim * num1 + 1] += 0.5 * K_local[0][1];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] += 0.5 * K_local[1][0];
-                K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1] += 0.5 * K_local[1][1];
-
-                JK[K_pointer[pi->id] + pi->cell.dim * num1] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + pi->cell.dim * num1 + 1] = pi->cell.dim * (pj->id + 1);
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] = pi->cell.dim * (pj->id + 1) - 1;
-                JK[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1] = pi->cell.dim * (pj->id + 1);
+                assembleBlockFree(pi, pj, 0, K_local);
+                continue;
             }
-            else
+
+            K_global[K_pointer[pi->id]] += K_local[0][0];
+            K_global[K_pointer[pi->id] + 1] += K_local[0][1];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq)] += K_local[1][1];
+        }
+        else
+        {
+            // symmetrized block, 0.5 * (K_ij + K_ji^T)
+            std::array<std::array<double, NDIM>, NDIM> K_ij = localStiffness(pi, idx_j), K_ji = localStiffness(pj, pi->conn_slot[idx_j]), K_local;
+            for (int r = 0; r < NDIM; ++r)
+                for (int s = 0; s < NDIM; ++s)
+                    K_local[r][s] = 0.5 * K_ij[r][s] + 0.5 * K_ji[s][r];
+
+            int num1 = idx_j - idx_i; // index difference between i and j, in i's conn list
+            if (reduced_system)
             {
-                auto pt_i = std::find(pj->conns.begin(), pj->conns.end(), pi);
-                int num2 = pj->nconn_largeq - (int)std::distance(pt_i, pj->conns.end());
-                // if (pi->id == 40)
-                //      printf("%d, ", num2);
-                K_global[K_pointer[pj->id] + pi->cell.dim * num2] += 0.5 * K_local[0][0];
-                K_global[K_pointer[pj->id] + pi->cell.dim * num2 + 1] += 0.5 * K_local[1][0];
-                K_global[K_pointer[pj->id] + pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2 - 1] += 0.5 * K_local[0][1];
-                K_global[K_pointer[pj->id] + pi->cell.dim * (pj->nconn_largeq) + pi->cell.dim * num2] += 0.5 * K_local[1][1];
+                assembleBlockFree(pi, pj, num1, K_local);
+                continue;
             }
+            K_global[K_pointer[pi->id] + pi->cell.dim * num1] += K_local[0][0];
+            K_global[K_pointer[pi->id] + pi->cell.dim * num1 + 1] += K_local[0][1];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1 - 1] += K_local[1][0];
+            K_global[K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + pi->cell.dim * num1] += K_local[1][1];
+        }
+    }
+}
 
-            // if (pi->id == 40)
-            //     printf("%f, ", K_global[K_pointer[pj->id] + pi->cell.dim * 1 + 1]);
+template <int nlayer>
+void Stiffness<nlayer>::assembleBlockFree(Particle<nlayer> *pi, Particle<nlayer> *pj, int num1, const std::array<std::array<double, NDIM>, NDIM> &K_local)
+{
+    // the upper triangle of block (i, j) without the eliminated rows and columns, its free entries of a row are
+    // consecutive in K_free
+    int dim = pi->cell.dim;
+    for (int r = 0; r < dim; ++r)
+    {
+        if (free_dof[dim * pi->id + r] < 0)
+            continue;
+        MKL_INT pos = K_free_pos[pi->id][r * pi->nconn_largeq + num1];
+        for (int s = (num1 == 0) ? r : 0; s < dim; ++s)
+        {
+            if (free_dof[dim * pj->id + s] >= 0)
+                K_free[pos++] += K_local[r][s];
         }
+    }
+}
+
+template <int nlayer>
+bool Stiffness<nlayer>::calcStiffnessIncremental(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    // after the first steps the bonds only change around the damage (and plastic) zone, so the blocks of the other
+    // particles are kept from the last assembly, at the positions of that one, until the next full assembly
+    updateSystemPattern(pt_sys);
+    if (consistent_tangent || assembled_version != system_version || ++n_incremental > full_interval)
+        return false;
 
-        IK[pi->cell.dim * pi->id] = K_pointer[pi->id] + 1;
-        IK[pi->cell.dim * pi->id + 1] = K_pointer[pi->id] + pi->cell.dim * (pi->nconn_largeq) + 1;
-        // if (pi->id == 40)
-        //     printf("%d, ", IK[pi->cell.dim * pi->id]);
+    BondStore<nlayer> &bs = *pt_sys[0]->bonds;
+    std::vector<char> dirty(pt_sys.size(), 0);
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        bool changed = pt->damage != damage_asm[pt->id];
+        for (int bd = pt->bond_ptr[0]; bd < pt->bond_ptr[nlayer] && !changed; ++bd)
+            changed = bs.bdamage[bd] != bdamage_asm[bd] || bs.dLp[bd] != dLp_asm[bd];
+        dirty[pt->id] = changed;
+    }
+
+    // the internal forces of a dirty particle and of its neighbors (opposite bond forces) change, i.e., their block rows,
+    // and the symmetrized blocks of these rows are stored in the rows of their conns
+    std::vector<char> in_rows(pt_sys.size(), 0), in_cols(pt_sys.size(), 0);
+    std::vector<Particle<nlayer> *> rows, cols;
+    auto addRow = [&](Particle<nlayer> *pr)
+    {
+        if (in_rows[pr->id])
+            return;
+        in_rows[pr->id] = 1;
+        rows.push_back(pr);
+        for (Particle<nlayer> *pc : pr->conns)
+        {
+            if (!in_cols[pc->id])
+                in_cols[pc->id] = 1, cols.push_back(pc);
+        }
+    };
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        if (!dirty[pt->id])
+            continue;
+        addRow(pt);
+        for (int bd = pt->bond_ptr[0]; bd < pt->bond_ptr[nlayer]; ++bd)
+            addRow(bs.p2[bd]);
+    }
+    if (2 * cols.size() > pt_sys.size())
+        return false; // not worth it
+
+    if (mode == StiffnessMode::FiniteDifference)
+        calcBlocksFD(pt_sys, cols);
+    else if (mode == StiffnessMode::AutomaticDifferentiation)
+        calcBlocksAD(pt_sys, cols);
+    else
+        calcBlocksANA(pt_sys, rows);
+
+    // the displacement BCs have changed K_global, start from the assembled one (the reduced system is not changed by them)
+    if (!reduced_system)
+        std::copy(K_assembled.begin(), K_assembled.end(), K_global);
+#pragma omp parallel for
+    for (Particle<nlayer> *pi : cols)
+    {
+        if (!reduced_system)
+            std::fill(K_global + K_pointer[pi->id], K_global + K_pointer[pi->id + 1], 0.0);
+        for (int k = 0; reduced_system && k < pi->cell.dim; ++k)
+        {
+            MKL_INT r = free_dof[pi->cell.dim * pi->id + k];
+            if (r >= 0)
+                std::fill(K_free.begin() + IK_free[r] - 1, K_free.begin() + IK_free[r + 1] - 1, 0.0);
+        }
+        if (pi->cell.dim == 2)
+            assembleRow2D(pi);
+        else
+            assembleRow3D(pi);
+    }
+
+    storeAssembled(pt_sys, false);
+    return true;
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::storeAssembled(std::vector<Particle<nlayer> *> &pt_sys, bool full)
+{
+    BondStore<nlayer> &bs = *pt_sys[0]->bonds;
+    if (reduced_system)
+        K_assembled = K_free;
+    else
+        K_assembled.assign(K_global, K_global + K_pointer[pt_sys.size()]);
+    bdamage_asm = bs.bdamage;
+    dLp_asm = bs.dLp;
+    damage_asm.resize(pt_sys.size());
+    for (Particle<nlayer> *pt : pt_sys)
+        damage_asm[pt->id] = pt->damage;
+
+    if (full)
+    {
+        n_incremental = 0;
+        assembled_version = system_version;
     }
-    IK[pt_sys[0]->cell.dim * pt_sys.size()] = K_pointer[pt_sys.size()] + 1;
 }
 
 template <int nlayer>
 void Stiffness<nlayer>::updateStiffnessDispBC(std::vector<Particle<nlayer> *> &pt_sys)
 {
+    ++values_version;
+    updateEliminated(pt_sys);
+
+    if (reduced_system)
+        return; // assembled without the eliminated DOFs
+
     double *diag = new double[pt_sys[0]->cell.dim * pt_sys.size()]; /* diagonal vector of stiffness matrix */
 
     /* extract the diagonal vector of stiffness matrix */
@@ -423,8 +960,7 @@ void Stiffness<nlayer>::updateStiffnessDispBC(std::vector<Particle<nlayer> *> &p
                     }
                     else // pj->id < pi->id
                     {
-                        auto pt_i = std::find(pj->conns.begin(), pj->conns.end(), pi);
-                        int num2 = pj->nconn_largeq - (int)std::distance(pt_i, pj->conns.end());
+                        int num2 = K_num[pi->id][idx_j]; // position of pi in the block row of pj
                         K_global[K_pointer[pj->id] + pj->cell.dim * num2 + k] = 0;
                         K_global[K_pointer[pj->id] + pj->cell.dim * (pj->nconn_largeq) + pj->cell.dim * num2 - 1 + k] = 0;
                         if (pi->cell.dim == 3)
@@ -437,4 +973,296 @@ void Stiffness<nlayer>::updateStiffnessDispBC(std::vector<Particle<nlayer> *> &p
     }
 }
 
-#endif
\ No newline at end of file
+template <int nlayer>
+void Stiffness<nlayer>::updateEliminated(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    std::vector<char> dof_eliminated(n_dof, 0);
+#pragma omp parallel for
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        for (int k = 0; k < pt->cell.dim; ++k)
+            dof_eliminated[pt->cell.dim * pt->id + k] = (pt->disp_constraint[k] == 1 || abs(pt->damage_visual - 1.0) < EPS);
+    }
+    if (dof_eliminated != eliminated)
+    {
+        eliminated.swap(dof_eliminated);
+        ++bc_version;
+    }
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::multiplyTangent(std::vector<Particle<nlayer> *> &pt_sys, const double *x, double *y)
+{
+    // the assembly only keeps the symmetric part of the blocks, the consistent tangent is not symmetric; x and y are
+    // vectors of the system (reduced or full), the eliminated rows of the full system stay decoupled
+    int dim = pt_sys[0]->cell.dim;
+    std::vector<MKL_INT> dofs = systemDofs();
+#pragma omp parallel for
+    for (Particle<nlayer> *pi : pt_sys)
+    {
+        std::array<double, NDIM> yi{0, 0, 0};
+        for (int k = 0; k < pi->nconn; ++k)
+        {
+            int j = pi->conns[k]->id;
+            std::array<std::array<double, NDIM>, NDIM> K_ij = localStiffness(pi, k);
+            for (int s = 0; s < dim; ++s)
+            {
+                MKL_INT c = dofs[dim * j + s];
+                if (c < 0)
+                    continue;
+                for (int r = 0; r < dim; ++r)
+                    yi[r] += K_ij[r][s] * x[c];
+            }
+        }
+        for (int r = 0; r < dim; ++r)
+        {
+            MKL_INT c = dofs[dim * pi->id + r];
+            if (c >= 0)
+                y[c] = yi[r];
+            else if (!reduced_system)
+                y[dim * pi->id + r] = x[dim * pi->id + r];
+        }
+    }
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::updateSystemPattern(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    // the reduced system is assembled directly, without the full matrix, so its pattern is built from the displacement
+    // BCs of the load step before the assembly
+    if (reduced_system)
+    {
+        reduceSystem(pt_sys);
+        return;
+    }
+    if (!free_dof.empty())
+    {
+        // switched back from the reduced system
+        free_dof.clear();
+        free_version = -1;
+        ++system_version;
+    }
+    if (K_global == nullptr)
+        K_global = new double[K_pointer[pt_sys.size()]]{};
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::reduceSystem(std::vector<Particle<nlayer> *> &pt_sys)
+{
+    // the free DOFs are numbered in particle order, so the rows of the reduced system keep the upper triangle order of
+    // K_global, and its pattern only has to be built again when the conns or the set of eliminated DOFs change
+    int dim = pt_sys[0]->cell.dim;
+    std::vector<MKL_INT> dof_map(n_dof, -1);
+    MKL_INT n{0};
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        for (int k = 0; k < dim; ++k)
+        {
+            if (pt->disp_constraint[k] == 0 && abs(pt->damage_visual - 1.0) >= EPS)
+                dof_map[dim * pt->id + k] = n++;
+        }
+    }
+
+    if (free_version != pattern_version || dof_map != free_dof)
+    {
+        free_dof.swap(dof_map);
+        n_free = n;
+        free_version = pattern_version;
+
+        // count the free columns of each free row, then fill them
+        IK_free.assign(n_free + 1, 0);
+#pragma omp parallel for
+        for (MKL_INT r = 0; r < n_dof; ++r)
+        {
+            if (free_dof[r] < 0)
+                continue;
+            MKL_INT count{0};
+            for (MKL_INT e = IK[r] - 1; e < IK[r + 1] - 1; ++e)
+                count += (free_dof[JK[e] - 1] >= 0);
+            IK_free[free_dof[r] + 1] = count;
+        }
+        IK_free[0] = 1;
+        for (MKL_INT r = 0; r < n_free; ++r)
+            IK_free[r + 1] += IK_free[r];
+
+        JK_free.resize(IK_free[n_free] - 1);
+#pragma omp parallel for
+        for (MKL_INT r = 0; r < n_dof; ++r)
+        {
+            if (free_dof[r] < 0)
+                continue;
+            MKL_INT pos = IK_free[free_dof[r]] - 1;
+            for (MKL_INT e = IK[r] - 1; e < IK[r + 1] - 1; ++e)
+            {
+                if (free_dof[JK[e] - 1] >= 0)
+                    JK_free[pos++] = free_dof[JK[e] - 1] + 1;
+            }
+        }
+
+        // start of the free entries of each block of a free row, in the conn order of the block row as in K_global
+        K_free_pos.resize(pt_sys.size());
+#pragma omp parallel for
+        for (Particle<nlayer> *pi : pt_sys)
+        {
+            int idx_i = pi->nconn - pi->nconn_largeq; // index of pi in its own conn list
+            K_free_pos[pi->id].assign(dim * pi->nconn_largeq, -1);
+            for (int r = 0; r < dim; ++r)
+            {
+                if (free_dof[dim * pi->id + r] < 0)
+                    continue;
+                MKL_INT pos = IK_free[free_dof[dim * pi->id + r]] - 1;
+                for (int b = 0; b < pi->nconn_largeq; ++b)
+                {
+                    K_free_pos[pi->id][r * pi->nconn_largeq + b] = pos;
+                    for (int s = (b == 0) ? r : 0; s < dim; ++s)
+                        pos += (free_dof[dim * pi->conns[idx_i + b]->id + s] >= 0);
+                }
+            }
+        }
+
+        // the full matrix is not assembled while the reduced system is used
+        delete[] K_global;
+        K_global = nullptr;
+        K_free.resize(IK_free[n_free] - 1);
+        residual_free.resize(n_free);
+        ++system_version;
+        printf("Reduced system: %lld of %lld DOFs are free\n", (long long)n_free, (long long)n_dof);
+    }
+}
+
+template <int nlayer>
+std::vector<MKL_INT> Stiffness<nlayer>::systemBlocks(int dim)
+{
+    // the DOFs of a particle are consecutive in both systems, a particle without free DOFs has no block
+    std::vector<MKL_INT> blocks;
+    for (MKL_INT r = 0; r < n_dof; r += dim)
+    {
+        if (!reduced_system)
+            blocks.push_back(r);
+        else
+        {
+            for (int k = 0; k < dim; ++k)
+            {
+                if (free_dof[r + k] >= 0)
+                {
+                    blocks.push_back(free_dof[r + k]);
+                    break;
+                }
+            }
+        }
+    }
+    blocks.push_back(systemSize());
+    return blocks;
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::systemGraph(std::vector<Particle<nlayer> *> &pt_sys, std::vector<MKL_INT> &g_ptr, std::vector<MKL_INT> &g_adj)
+{
+    // nodes are the particles with a block in the system (see systemBlocks), connected if they are bonded conns
+    int dim = pt_sys[0]->cell.dim;
+    std::vector<int> node(pt_sys.size(), -1);
+    int nnode{0};
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        for (int k = 0; k < dim; ++k)
+        {
+            if (!reduced_system || free_dof[dim * pt->id + k] >= 0)
+            {
+                node[pt->id] = nnode++;
+                break;
+            }
+        }
+    }
+
+    g_ptr.assign(1, 0);
+    g_adj.clear();
+    for (Particle<nlayer> *pi : pt_sys)
+    {
+        if (node[pi->id] < 0)
+            continue;
+        double cutoff = 1.01 * pi->cell.neighbor_cutoff.back();
+        for (Particle<nlayer> *pj : pi->conns)
+        {
+            if (pj == pi || node[pj->id] < 0)
+                continue;
+            double d2{0};
+            for (int k = 0; k < dim; ++k)
+                d2 += (pj->xyz[k] - pi->xyz[k]) * (pj->xyz[k] - pi->xyz[k]);
+            if (d2 <= cutoff * cutoff)
+                g_adj.push_back(node[pj->id]);
+        }
+        g_ptr.push_back(g_adj.size());
+    }
+}
+
+template <int nlayer>
+std::vector<MKL_INT> Stiffness<nlayer>::systemDofs()
+{
+    // the DOFs that are constrained or fully damaged are not solved for, in the full system their rows are decoupled
+    std::vector<MKL_INT> dofs(n_dof, -1);
+    for (MKL_INT r = 0; r < n_dof; ++r)
+    {
+        MKL_INT s = reduced_system ? free_dof[r] : r;
+        if (s >= 0 && !eliminated[r])
+            dofs[r] = s;
+    }
+    return dofs;
+}
+
+template <int nlayer>
+std::vector<double> Stiffness<nlayer>::systemRigidModes(std::vector<Particle<nlayer> *> &pt_sys, int &nB)
+{
+    // translations and (linearized) rotations about the centroid at each system DOF, zero at the DOFs that are
+    // constrained or fully damaged in the full system (their rows are decoupled)
+    int dim = pt_sys[0]->cell.dim;
+    nB = (dim == 2) ? 3 : 6;
+    std::array<double, NDIM> c{0, 0, 0};
+    for (Particle<nlayer> *pt : pt_sys)
+        for (int k = 0; k < dim; ++k)
+            c[k] += pt->xyz[k] / pt_sys.size();
+
+    std::vector<double> B(systemSize() * nB, 0.0);
+    for (Particle<nlayer> *pt : pt_sys)
+    {
+        double x = pt->xyz[0] - c[0], y = pt->xyz[1] - c[1], z = pt->xyz[2] - c[2];
+        for (int k = 0; k < dim; ++k)
+        {
+            MKL_INT r = dim * pt->id + k;
+            MKL_INT s = reduced_system ? free_dof[r] : r;
+            if (s < 0 || eliminated[r])
+                continue;
+            double *b = &B[s * nB];
+            b[k] = 1.0;
+            if (dim == 2)
+                b[2] = (k == 0) ? -y : x;
+            else if (k == 0)
+                b[4] = z, b[5] = -y;
+            else if (k == 1)
+                b[3] = -z, b[5] = x;
+            else
+                b[3] = y, b[4] = -x;
+        }
+    }
+    return B;
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::gatherResidual()
+{
+#pragma omp parallel for
+    for (MKL_INT r = 0; r < n_dof; ++r)
+    {
+        if (free_dof[r] >= 0)
+            residual_free[free_dof[r]] = residual[r];
+    }
+}
+
+template <int nlayer>
+void Stiffness<nlayer>::scatterSolution(const double *x_free, double *x)
+{
+#pragma omp parallel for
+    for (MKL_INT r = 0; r < n_dof; ++r)
+        x[r] = (free_dof[r] >= 0) ? x_free[free_dof[r]] : 0.0;
+}
+
+#endif
@@ -34,6 +34,7 @@
 // #include "ex6_Ti64_2d_fatigue_crack_G6a.cpp"
 // #include "ex6_Ti64_2d_fatigue_crack_calib.cpp"
 // #include "ex7_convergence_beam.cpp"
+// #include "ex8_omp_scaling.cpp"
 #include "plasticity/J2_3DSC.cpp"
 
 /************************************************************************/